@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# npm2100_nrf54l15_BFG
+# bench_compare.py
+# compares the BENCH lines of a benchmark log against a checked in baseline.
+# auth: ddhd
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+#   python3 scripts/bench_compare.py bench/nrf54l15dk_nrf54l15_cpuapp.txt uart.log
+#   python3 scripts/bench_compare.py --update bench/nrf54l15dk_nrf54l15_cpuapp.txt uart.log
+#   python3 scripts/bench_compare.py --allow-empty bench/native_sim.txt twister.log
+
+import argparse
+import re
+import sys
+
+LINE = re.compile(r"BENCH (\S+) unit=(\S+) n=(\d+) min=(\d+) median=(\d+) p99=(\d+) max=(\d+)")
+
+
+def parse(lines):
+    results = {}
+    for line in lines:
+        m = LINE.search(line)
+        if m:
+            results[m.group(1)] = {"line": m.group(0), "unit": m.group(2), "median": int(m.group(5)),
+                                   "p99": int(m.group(6))}
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description="compare BENCH results against a baseline")
+    parser.add_argument("baseline", help="baseline file, BENCH lines as printed by the firmware")
+    parser.add_argument("log", nargs="?", help="log with BENCH lines, stdin if omitted")
+    parser.add_argument("--threshold", type=float, default=10.0, help="allowed median/p99 increase in percent")
+    parser.add_argument("--update", action="store_true", help="write the log's results as the new baseline")
+    parser.add_argument("--allow-empty", action="store_true",
+                        help="only list the results when the baseline has none recorded yet, instead of failing")
+    args = parser.parse_args()
+
+    with open(args.log) if args.log else sys.stdin as f:
+        current = parse(f)
+    if not current:
+        sys.exit("no BENCH lines in the log")
+
+    if args.update:
+        with open(args.baseline, "w") as f:
+            f.write("# recorded with scripts/bench_compare.py --update\n")
+            for name in sorted(current):
+                f.write(current[name]["line"] + "\n")
+        print(f"{len(current)} cases written to {args.baseline}")
+        return
+
+    try:
+        with open(args.baseline) as f:
+            baseline = parse(f)
+    except FileNotFoundError:
+        baseline = {}
+    # an empty baseline would pass every run, so it only lists the results when asked to
+    if not baseline:
+        if not args.allow_empty:
+            sys.exit(f"no BENCH lines in {args.baseline}, record a baseline with --update")
+        print(f"no BENCH lines in {args.baseline} yet, nothing compared")
+
+    regressions = 0
+    for name in sorted(current):
+        cur = current[name]
+        base = baseline.get(name)
+        if base is None:
+            print(f"{name:18} new, no baseline")
+            continue
+        if base["unit"] != cur["unit"]:
+            print(f"{name:18} unit changed ({base['unit']} -> {cur['unit']}), not compared")
+            continue
+        verdict = "ok"
+        for key in ("median", "p99"):
+            if base[key] and (cur[key] - base[key]) * 100.0 / base[key] > args.threshold:
+                verdict = "REGRESSION"
+        regressions += verdict != "ok"
+        print(f"{name:18} median {base['median']} -> {cur['median']}, p99 {base['p99']} -> {cur['p99']} "
+              f"{cur['unit']}  {verdict}")
+
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,43 @@
+# Application modules, shared by CMakeLists.txt and the test apps under tests/.
+# main() is not part of it, every app brings its own.
+
+set(APP_SRC ${CMAKE_CURRENT_LIST_DIR}/src)
+
+zephyr_include_directories(${APP_SRC}/common ${APP_SRC}/ble ${APP_SRC}/pmic ${APP_SRC}/adc ${APP_SRC}/sim) # (inc .)
+
+target_sources(app PRIVATE
+	${APP_SRC}/common/telemetry.c
+	${APP_SRC}/common/sched.c
+	${APP_SRC}/common/counters.c
+	${APP_SRC}/common/energy.c
+	${APP_SRC}/common/rtpm.c
+	${APP_SRC}/ble/ble_periph_pmic.c
+	${APP_SRC}/ble/ble_gate.c
+	${APP_SRC}/pmic/pmic.c
+	${APP_SRC}/adc/npm_adc.c
+)
+
+target_sources_ifdef(CONFIG_BLE_REPORT_FORMAT_BINARY app PRIVATE ${APP_SRC}/ble/ble_history.c)
+target_sources_ifdef(CONFIG_BLE_CONN_PARAM app PRIVATE ${APP_SRC}/ble/ble_conn_param.c)
+target_sources_ifdef(CONFIG_PIPELINE app PRIVATE ${APP_SRC}/common/pipeline.c)
+target_sources_ifdef(CONFIG_DIAG app PRIVATE ${APP_SRC}/common/diag.c)
+target_sources_ifdef(CONFIG_FG_PERSIST app PRIVATE ${APP_SRC}/pmic/fg_persist.c)
+target_sources_ifdef(CONFIG_LSLDO_PROFILE app PRIVATE ${APP_SRC}/pmic/lsldo_profile.c)
+target_sources_ifdef(CONFIG_PMIC_EVENTS app PRIVATE ${APP_SRC}/pmic/pmic_events.c)
+target_sources_ifdef(CONFIG_ADC_BURST app PRIVATE ${APP_SRC}/adc/adc_burst.c)
+target_sources_ifdef(CONFIG_BENCH app PRIVATE ${APP_SRC}/common/bench.c)
+
+if(CONFIG_SINGLE_PRECISION_ONLY)
+	target_compile_options(app PRIVATE -Werror=double-promotion -fsingle-precision-constant)
+endif()
+
+# host build, emulated nPM2100 and SAADC instead of the EK and DK wiring
+target_sources_ifdef(CONFIG_BOARD_NATIVE_SIM app PRIVATE
+	${APP_SRC}/sim/emul_npm2100.c
+	${APP_SRC}/sim/sim_rails.c
+)
+
+# the benchmark clock runs in the host context of the executable, with the host C library
+if(CONFIG_BOARD_NATIVE_SIM AND CONFIG_BENCH)
+	target_sources(native_simulator INTERFACE ${APP_SRC}/sim/bench_host_clock.c)
+endif()
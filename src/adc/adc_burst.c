@@ -0,0 +1,335 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * adc_burst.c
+ * on-demand burst capture of the BOOST and LS/LDO rails, reduced on-device to ripple statistics with CMSIS-DSP.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include <arm_math.h>
+
+#include "adc_burst.h"
+#include "npm_adc.h"
+
+LOG_MODULE_REGISTER(adc_burst, LOG_LEVEL_INF);
+
+#define ADC_BURST_SAMPLES CONFIG_ADC_BURST_SAMPLES
+#define ADC_BURST_BINS (ADC_BURST_SAMPLES / 2)
+#define ADC_BURST_CHANNELS 2
+#define ADC_BURST_RESOLUTION 14 // bits of a raw conversion
+// the block sampler hands the SAADC over at the end of its block, which can take a full ADC period
+#define ADC_BURST_ACQUIRE_TIMEOUT K_SECONDS(120)
+
+BUILD_ASSERT(IS_POWER_OF_TWO(ADC_BURST_SAMPLES), "the real FFT needs a power of two length");
+
+struct adc_burst_channel
+{
+    int32_t min_uv;
+    int32_t max_uv;
+    int32_t mean_uv;
+    uint32_t rms_uv; // AC part only, the mean is removed first
+    uint32_t p2p_uv;
+    uint32_t peak_hz; // strongest non-DC bin
+    uint16_t band_uv[CONFIG_ADC_BURST_BANDS];
+};
+
+struct adc_burst_summary
+{
+    uint8_t channels;
+    uint8_t seq;
+    uint32_t sample_ns;
+    struct adc_burst_channel ch[ADC_BURST_CHANNELS];
+};
+
+/* The SAADC DMA writes raw conversions straight into burst_samples, which CMSIS-DSP then treats as
+ * q15. The real FFT output is interleaved complex and twice as long, the magnitudes go back into
+ * burst_samples once the time domain data is no longer needed.
+ */
+static q15_t burst_samples[ADC_BURST_SAMPLES];
+static q15_t burst_spectrum[2 * ADC_BURST_SAMPLES];
+static arm_rfft_instance_q15 burst_rfft;
+
+static struct adc_burst_summary summary;
+static bool summary_valid;
+static K_MUTEX_DEFINE(summary_lock);
+
+static uint8_t burst_channels;
+static adc_burst_done_t burst_done;
+static atomic_t burst_running;
+static K_SEM_DEFINE(burst_start, 0, 1);
+
+// raw codes scaled up by shift bits to uV, full_uv is the conversion of 1 << ADC_BURST_RESOLUTION
+static int64_t burst_to_uv(int64_t codes, int shift, int32_t full_uv)
+{
+    return (codes * full_uv) >> (ADC_BURST_RESOLUTION + shift);
+}
+
+// reduce the capture in burst_samples, capture_ns is the measured duration of the whole capture
+static void burst_reduce(size_t ch, uint64_t capture_ns, struct adc_burst_channel *out)
+{
+    int32_t full_uv = BIT(ADC_BURST_RESOLUTION);
+    q15_t min;
+    q15_t max;
+    q15_t mean;
+    q15_t rms;
+    uint32_t idx;
+
+    if (npm_adc_raw_to_uv(ch, &full_uv) < 0)
+    {
+        full_uv = 0;
+    }
+
+    arm_min_q15(burst_samples, ADC_BURST_SAMPLES, &min, &idx);
+    arm_max_q15(burst_samples, ADC_BURST_SAMPLES, &max, &idx);
+    arm_mean_q15(burst_samples, ADC_BURST_SAMPLES, &mean);
+
+    // remove DC and scale the ripple up to the q15 range, so RMS and FFT keep their precision
+    int32_t swing = MAX(max - mean, mean - min);
+    int shift = 0;
+
+    while (shift < ADC_BURST_RESOLUTION && swing > 0 && (swing << (shift + 1)) <= INT16_MAX)
+    {
+        shift++;
+    }
+    arm_offset_q15(burst_samples, -mean, burst_samples, ADC_BURST_SAMPLES);
+    arm_shift_q15(burst_samples, shift, burst_samples, ADC_BURST_SAMPLES);
+    arm_rms_q15(burst_samples, ADC_BURST_SAMPLES, &rms);
+
+    arm_rfft_q15(&burst_rfft, burst_samples, burst_spectrum);
+    arm_cmplx_mag_q15(burst_spectrum, burst_samples, ADC_BURST_BINS);
+
+    /* The q15 RFFT output is scaled down by N/2 and the magnitude is in 2.14, so a sine of
+     * amplitude A shows up as A/2 in its bin.
+     */
+    size_t peak_bin = 1;
+
+    for (size_t band = 0; band < CONFIG_ADC_BURST_BANDS; band++)
+    {
+        size_t first = 1 + band * (ADC_BURST_BINS - 1) / CONFIG_ADC_BURST_BANDS;
+        size_t last = 1 + (band + 1) * (ADC_BURST_BINS - 1) / CONFIG_ADC_BURST_BANDS;
+        q15_t band_mag = 0;
+
+        for (size_t bin = first; bin < last; bin++)
+        {
+            band_mag = MAX(band_mag, burst_samples[bin]);
+            if (burst_samples[bin] > burst_samples[peak_bin])
+            {
+                peak_bin = bin;
+            }
+        }
+        out->band_uv[band] = (uint16_t)MIN(burst_to_uv(2 * band_mag, shift, full_uv), UINT16_MAX);
+    }
+
+    out->min_uv = (int32_t)burst_to_uv(min, 0, full_uv);
+    out->max_uv = (int32_t)burst_to_uv(max, 0, full_uv);
+    out->mean_uv = (int32_t)burst_to_uv(mean, 0, full_uv);
+    out->rms_uv = (uint32_t)burst_to_uv(rms, shift, full_uv);
+    out->p2p_uv = (uint32_t)burst_to_uv(max - min, 0, full_uv);
+    // bin k of an N point FFT is k cycles over the capture
+    out->peak_hz = capture_ns ? (uint32_t)((uint64_t)peak_bin * NSEC_PER_SEC / capture_ns) : 0;
+}
+
+static void burst_run(uint8_t channels)
+{
+    struct adc_burst_summary result = {.channels = channels};
+    uint64_t total_ns = 0;
+    size_t captured = 0;
+    int err;
+
+    err = npm_adc_acquire(ADC_BURST_ACQUIRE_TIMEOUT);
+    if (err)
+    {
+        LOG_ERR("ADC not available for the burst (%d)", err);
+        return;
+    }
+
+    for (size_t ch = 0; ch < ADC_BURST_CHANNELS && !err; ch++)
+    {
+        if (!(channels & BIT(ch)))
+        {
+            continue;
+        }
+
+        uint32_t start = k_cycle_get_32();
+        err = npm_adc_capture_raw(ch, burst_samples, ADC_BURST_SAMPLES, 0);
+        // measured rather than configured, back to back sampling has no nominal interval
+        uint64_t capture_ns = k_cyc_to_ns_floor64(k_cycle_get_32() - start);
+
+        if (!err)
+        {
+            burst_reduce(ch, capture_ns, &result.ch[ch]);
+            total_ns += capture_ns;
+            captured++;
+        }
+    }
+    npm_adc_release();
+    if (err)
+    {
+        return;
+    }
+    result.sample_ns = (uint32_t)(total_ns / (captured * ADC_BURST_SAMPLES));
+
+    k_mutex_lock(&summary_lock, K_FOREVER);
+    result.seq = summary.seq + 1;
+    summary = result;
+    summary_valid = true;
+    k_mutex_unlock(&summary_lock);
+
+    for (size_t ch = 0; ch < ADC_BURST_CHANNELS; ch++)
+    {
+        const struct adc_burst_channel *c = &result.ch[ch];
+
+        if (channels & BIT(ch))
+        {
+            LOG_INF("ch%d: mean %d uV, p-p %u uV, rms %u uV, peak at %u Hz", (int)ch, c->mean_uv, c->p2p_uv,
+                    c->rms_uv, c->peak_hz);
+        }
+    }
+}
+
+int adc_burst_request(uint8_t channels, adc_burst_done_t done)
+{
+    channels &= BIT_MASK(ADC_BURST_CHANNELS);
+    if (channels == 0)
+    {
+        return -EINVAL;
+    }
+    if (!atomic_cas(&burst_running, 0, 1))
+    {
+        return -EBUSY;
+    }
+
+    burst_channels = channels;
+    burst_done = done;
+    k_sem_give(&burst_start);
+    return 0;
+}
+
+size_t adc_burst_encode(uint8_t *buf, size_t size)
+{
+    size_t len = 0;
+
+    k_mutex_lock(&summary_lock, K_FOREVER);
+    if (summary_valid && size >= ADC_BURST_MAXLEN)
+    {
+        buf[0] = ADC_BURST_VERSION;
+        buf[1] = summary.channels;
+        buf[2] = summary.seq;
+        sys_put_le16(ADC_BURST_SAMPLES, &buf[3]);
+        sys_put_le32(summary.sample_ns, &buf[5]);
+        len = ADC_BURST_HDR_LEN;
+
+        for (size_t ch = 0; ch < ADC_BURST_CHANNELS; ch++)
+        {
+            const struct adc_burst_channel *c = &summary.ch[ch];
+
+            if (!(summary.channels & BIT(ch)))
+            {
+                continue;
+            }
+            buf[len++] = ch;
+            sys_put_le32(c->min_uv, &buf[len]);
+            sys_put_le32(c->max_uv, &buf[len + 4]);
+            sys_put_le32(c->mean_uv, &buf[len + 8]);
+            sys_put_le32(c->rms_uv, &buf[len + 12]);
+            sys_put_le32(c->p2p_uv, &buf[len + 16]);
+            sys_put_le32(c->peak_hz, &buf[len + 20]);
+            len += 24;
+            for (size_t band = 0; band < CONFIG_ADC_BURST_BANDS; band++, len += 2)
+            {
+                sys_put_le16(c->band_uv[band], &buf[len]);
+            }
+        }
+    }
+    k_mutex_unlock(&summary_lock);
+    return len;
+}
+
+void adc_burst_thread(void)
+{
+    if (arm_rfft_init_q15(&burst_rfft, ADC_BURST_SAMPLES, 0, 1) != ARM_MATH_SUCCESS)
+    {
+        LOG_ERR("No RFFT for %d points", ADC_BURST_SAMPLES);
+        return;
+    }
+
+    for (;;)
+    {
+        k_sem_take(&burst_start, K_FOREVER);
+        adc_burst_done_t done = burst_done;
+
+        burst_run(burst_channels);
+        atomic_set(&burst_running, 0);
+        if (done)
+        {
+            done();
+        }
+    }
+}
+
+K_THREAD_DEFINE(adc_burst_thread_id, CONFIG_ADC_BURST_STACK_SIZE, adc_burst_thread, NULL, NULL, NULL,
+                CONFIG_ADC_BURST_PRIORITY, 0, 0);
+
+#if defined(CONFIG_SHELL)
+
+static int cmd_burst_run(const struct shell *sh, size_t argc, char **argv)
+{
+    uint8_t channels = (argc > 1) ? (uint8_t)strtoul(argv[1], NULL, 0) : BIT_MASK(ADC_BURST_CHANNELS);
+    int err = adc_burst_request(channels, NULL);
+
+    if (err)
+    {
+        shell_error(sh, "burst not started (%d)", err);
+    }
+    return err;
+}
+
+static int cmd_burst_show(const struct shell *sh, size_t argc, char **argv)
+{
+    struct adc_burst_summary s;
+
+    k_mutex_lock(&summary_lock, K_FOREVER);
+    s = summary;
+    bool valid = summary_valid;
+    k_mutex_unlock(&summary_lock);
+
+    if (!valid)
+    {
+        shell_print(sh, "no burst yet");
+        return 0;
+    }
+    shell_print(sh, "burst %u: %d samples per channel, %u ns apart", s.seq, ADC_BURST_SAMPLES, s.sample_ns);
+    for (size_t ch = 0; ch < ADC_BURST_CHANNELS; ch++)
+    {
+        const struct adc_burst_channel *c = &s.ch[ch];
+
+        if (!(s.channels & BIT(ch)))
+        {
+            continue;
+        }
+        shell_print(sh, "ch%d: min %d max %d mean %d rms %u p-p %u uV, peak at %u Hz", (int)ch, c->min_uv, c->max_uv,
+                    c->mean_uv, c->rms_uv, c->p2p_uv, c->peak_hz);
+        for (size_t band = 0; band < CONFIG_ADC_BURST_BANDS; band++)
+        {
+            shell_print(sh, "  band %d: %u uV", (int)band, c->band_uv[band]);
+        }
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_adc_burst,
+                               SHELL_CMD_ARG(run, NULL, "[mask]: capture (bit 0 BOOST, bit 1 LS/LDO)", cmd_burst_run,
+                                             1, 1),
+                               SHELL_CMD(show, NULL, "Summary of the last burst", cmd_burst_show),
+                               SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(adc_burst, &sub_adc_burst, "Rail ripple burst capture", NULL);
+
+#endif
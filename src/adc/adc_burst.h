@@ -0,0 +1,34 @@
+#ifndef ADC_BURST_H_
+#define ADC_BURST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADC_BURST_VERSION 1
+
+/*
+ * Burst summary (Burst characteristic value and notification), little endian:
+ * header  [version u8][channel mask u8][sequence u8][samples per channel u16][sample period ns u32]
+ * then per captured channel, in channel order:
+ *         [channel u8][min uV i32][max uV i32][mean uV i32][AC RMS uV u32][peak to peak uV u32]
+ *         [dominant ripple frequency Hz u32]
+ *         [CONFIG_ADC_BURST_BANDS x peak amplitude uV u16, saturating]
+ * The bands split 0..fs/2 into equal parts (DC excluded). Amplitudes come from an unwindowed
+ * FFT, they are meant for spotting where the ripple is, not for precise measurements.
+ */
+#define ADC_BURST_HDR_LEN 9
+#define ADC_BURST_CH_LEN (25 + 2 * CONFIG_ADC_BURST_BANDS)
+#define ADC_BURST_MAXLEN (ADC_BURST_HDR_LEN + 2 * ADC_BURST_CH_LEN)
+
+// called from the burst thread once a summary is ready
+typedef void (*adc_burst_done_t)(void);
+
+/* Capture CONFIG_ADC_BURST_SAMPLES back to back samples of each channel in the mask (bit 0 BOOST,
+ * bit 1 LSLDO) and reduce them in the background. -EBUSY while a burst is running.
+ */
+int adc_burst_request(uint8_t channels, adc_burst_done_t done);
+
+// encode the last summary into buf, returns the length used, 0 if no burst has completed yet
+size_t adc_burst_encode(uint8_t *buf, size_t size);
+
+#endif
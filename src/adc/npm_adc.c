@@ -6,18 +6,28 @@
  * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
  */
 
+#include <errno.h>
+#include <stdlib.h>
 #include <zephyr/devicetree.h>
 #include <zephyr/drivers/adc.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
 
+#include "bench.h"
+#include "counters.h"
+#include "fixed_point.h"
 #include "npm_adc.h"
+#include "rtpm.h"
+#include "sched.h"
+#include "telemetry.h"
 
 LOG_MODULE_REGISTER(adc, LOG_LEVEL_INF);
 
 #define ADC_THREAD_STACK_SIZE 1024
 #define ADC_THREAD_PRIORITY 5
-#define ADC_SAMPLE_INTERVAL K_SECONDS(1)
+#define ADC_CHANNEL_COUNT 2
+#define ADC_BLOCK_SAMPLES CONFIG_NPM_ADC_BLOCK_SAMPLES
 
 // define variable for each channel, get ADC channel specs from devicetree
 #define DT_SPEC_AND_COMMA(node_id, prop, idx) ADC_DT_SPEC_GET_BY_IDX(node_id, idx),
@@ -25,23 +35,171 @@ LOG_MODULE_REGISTER(adc, LOG_LEVEL_INF);
 static const struct adc_dt_spec adc_channels[] = {
     DT_FOREACH_PROP_ELEM(DT_PATH(zephyr_user), io_channels, DT_SPEC_AND_COMMA)};
 
-// can also use zbus, or pass with work container w/ kernel work item.
-// 8 messages, 4-byte alignment
-K_MSGQ_DEFINE(adc_msgq, sizeof(struct adc_sample_msg), 8, 4);
+BUILD_ASSERT(ARRAY_SIZE(adc_channels) == ADC_CHANNEL_COUNT, "expected BOOST and LSLDO io-channels");
 
-// Task dedicated to sampling the ADC
-void adc_sample_thread(void)
+/* Two sample blocks: the SAADC fills one (scan mode, channels interleaved) while the thread
+ * averages the other, so the thread wakes once per block instead of once per sample.
+ */
+static int16_t adc_blocks[2][ADC_BLOCK_SAMPLES][ADC_CHANNEL_COUNT];
+
+static struct adc_sequence_options adc_block_options = {
+    .extra_samplings = ADC_BLOCK_SAMPLES - 1,
+};
+
+static struct adc_sequence adc_block_sequence = {
+    .options = &adc_block_options,
+    .buffer_size = sizeof(adc_blocks[0]),
+    .resolution = 14,
+};
+
+// held by whoever owns the SAADC for captures
+static K_MUTEX_DEFINE(adc_capture_lock);
+
+#if !defined(CONFIG_PIPELINE)
+/* Capture handshake with the block sampler: 0 idle, 1 requested, 2 the sampler saw the request
+ * and is stopping, it then gives adc_capture_ready and waits for adc_capture_done.
+ */
+static atomic_t adc_capture_state;
+static K_SEM_DEFINE(adc_capture_ready, 0, 1);
+static K_SEM_DEFINE(adc_capture_done, 0, 1);
+
+static struct k_poll_signal adc_block_done = K_POLL_SIGNAL_INITIALIZER(adc_block_done);
+
+// start a block spread over period_ms, the scheduler picks the period per block
+static int adc_block_start(int16_t (*block)[ADC_CHANNEL_COUNT], uint32_t period_ms)
 {
-    int err;
-    int16_t buf[2];
+    adc_block_options.interval_us = period_ms * USEC_PER_MSEC / ADC_BLOCK_SAMPLES;
+    adc_block_sequence.buffer = block;
+    k_poll_signal_reset(&adc_block_done);
+
+    return adc_read_async(adc_channels[0].dev, &adc_block_sequence, &adc_block_done);
+}
+#endif
+
+// average a finished block per channel and convert to mV
+static void adc_block_reduce(int16_t (*block)[ADC_CHANNEL_COUNT], struct adc_sample_msg *msg)
+{
+    for (size_t ch = 0; ch < ADC_CHANNEL_COUNT; ch++)
+    {
+        int32_t sum = 0;
+
+        for (size_t i = 0; i < ADC_BLOCK_SAMPLES; i++)
+        {
+            sum += block[i][ch];
+        }
+
+        int32_t val_mv = sum / ADC_BLOCK_SAMPLES;
+        int err = adc_raw_to_millivolts_dt(&adc_channels[ch], &val_mv);
+        msg->channel_mv[ch] = (err < 0) ? -1 : val_mv;
+    }
+}
+
+/* Offset calibration scheduler. The SAADC offset drifts with temperature, not with the number of
+ * conversions, so blocks run without calibration. It calibrates once at startup (and after a failed
+ * read), then only when the nPM2100 die temperature moved by CONFIG_NPM_ADC_CAL_TEMP_DELTA or the
+ * last calibration is older than CONFIG_NPM_ADC_CAL_MAX_AGE_S. Only the sampling thread (or the
+ * pipeline step) calibrates, the lock is for readers of the stats.
+ */
+static const char *const adc_cal_reason_str[] = {
+    [NPM_ADC_CAL_STARTUP] = "startup",
+    [NPM_ADC_CAL_TEMP] = "temperature",
+    [NPM_ADC_CAL_AGE] = "age",
+};
+
+static struct npm_adc_cal_stats adc_cal;
+static struct k_spinlock adc_cal_lock;
+static bool adc_cal_needed = true;
+
+static bool adc_cal_due(const struct telemetry_snapshot *snap, enum npm_adc_cal_reason *reason)
+{
+    if (adc_cal_needed)
+    {
+        *reason = NPM_ADC_CAL_STARTUP;
+        return true;
+    }
+    if (CONFIG_NPM_ADC_CAL_MAX_AGE_S > 0 &&
+        k_uptime_get_32() - adc_cal.last_timestamp >= CONFIG_NPM_ADC_CAL_MAX_AGE_S * MSEC_PER_SEC)
+    {
+        *reason = NPM_ADC_CAL_AGE;
+        return true;
+    }
+    // the die temperature is reported by the fuel gauge step, nothing to compare before its first update
+    if (snap->pmic_gen != 0 && adc_cal.temp_valid &&
+        abs(snap->pmic.temp - adc_cal.last_temp) >= CONFIG_NPM_ADC_CAL_TEMP_DELTA * 100)
+    {
+        *reason = NPM_ADC_CAL_TEMP;
+        return true;
+    }
+    return false;
+}
+
+// calibrate the offset if it is due, before the next block is started
+static int adc_cal_schedule(void)
+{
+    struct telemetry_snapshot snap;
+    enum npm_adc_cal_reason reason;
+
+    telemetry_read(&snap);
+    if (!adc_cal_due(&snap, &reason))
+    {
+        if (!adc_cal.temp_valid && snap.pmic_gen != 0)
+        {
+            // calibrated before the first fuel gauge update, its temperature is the reference
+            k_spinlock_key_t key = k_spin_lock(&adc_cal_lock);
+            adc_cal.last_temp = snap.pmic.temp;
+            adc_cal.temp_valid = true;
+            k_spin_unlock(&adc_cal_lock, key);
+        }
+        return 0;
+    }
+
+    // a single conversion with the calibrate flag, the blocks themselves never calibrate
+    int16_t raw;
     struct adc_sequence sequence = {
-        .channels = BIT(adc_channels[0].channel_id) | BIT(adc_channels[1].channel_id),
-        .buffer = buf,
-        .buffer_size = sizeof(buf),
-        .resolution = 14,
+        .channels = BIT(adc_channels[0].channel_id),
+        .buffer = &raw,
+        .buffer_size = sizeof(raw),
+        .resolution = adc_block_sequence.resolution,
         .calibrate = true,
     };
-    struct adc_sample_msg msg;
+    uint32_t start = k_cycle_get_32();
+    int err = adc_read(adc_channels[0].dev, &sequence);
+    uint32_t cost_us = k_cyc_to_us_ceil32(k_cycle_get_32() - start);
+
+    if (err < 0)
+    {
+        LOG_ERR("Offset calibration failed (%d)", err);
+        adc_cal_needed = true;
+        return err;
+    }
+    counter_inc(COUNTER_ADC_CAL);
+    adc_cal_needed = false;
+
+    k_spinlock_key_t key = k_spin_lock(&adc_cal_lock);
+    adc_cal.count++;
+    adc_cal.by_reason[reason]++;
+    adc_cal.last_us = cost_us;
+    adc_cal.total_us += cost_us;
+    adc_cal.last_timestamp = k_uptime_get_32();
+    adc_cal.temp_valid = (snap.pmic_gen != 0);
+    adc_cal.last_temp = snap.pmic.temp;
+    k_spin_unlock(&adc_cal_lock, key);
+
+    LOG_INF("SAADC offset calibrated (%s): %u us, %u so far", adc_cal_reason_str[reason], cost_us, adc_cal.count);
+    return 0;
+}
+
+void npm_adc_cal_stats(struct npm_adc_cal_stats *out)
+{
+    k_spinlock_key_t key = k_spin_lock(&adc_cal_lock);
+
+    *out = adc_cal;
+    k_spin_unlock(&adc_cal_lock, key);
+}
+
+int npm_adc_init(void)
+{
+    int err;
 
     // Setup each channel
     for (size_t i = 0; i < ARRAY_SIZE(adc_channels); i++)
@@ -49,38 +207,410 @@ void adc_sample_thread(void)
         if (!adc_is_ready_dt(&adc_channels[i]))
         {
             LOG_ERR("ADC controller device %s not ready", adc_channels[i].dev->name);
-            return;
+            return -ENODEV;
         }
         err = adc_channel_setup_dt(&adc_channels[i]);
         if (err < 0)
         {
             LOG_ERR("Could not setup channel #%d (%d)", i, err);
-            return;
+            return err;
+        }
+        adc_block_sequence.channels |= BIT(adc_channels[i].channel_id);
+    }
+
+    return 0;
+}
+
+int npm_adc_capture_raw(size_t ch, int16_t *raw, size_t count, uint32_t interval_us)
+{
+    if (ch >= ARRAY_SIZE(adc_channels) || count == 0)
+    {
+        return -EINVAL;
+    }
+
+    struct adc_sequence_options options = {
+        .interval_us = interval_us,
+        .extra_samplings = count - 1,
+    };
+    struct adc_sequence sequence = {
+        .options = &options,
+        .channels = BIT(adc_channels[ch].channel_id),
+        .buffer = raw,
+        .buffer_size = count * sizeof(raw[0]),
+        .resolution = adc_block_sequence.resolution,
+    };
+    int err = adc_read(adc_channels[ch].dev, &sequence);
+    if (err < 0)
+    {
+        LOG_ERR("Capture on channel %d failed (%d)", (int)ch, err);
+        return err;
+    }
+    counter_inc(COUNTER_ADC_BLOCK);
+    counter_add(COUNTER_ADC_SAMPLE, (count + 1) / 2); // priced per sampling of both channels
+    return 0;
+}
+
+int npm_adc_raw_to_uv(size_t ch, int32_t *val)
+{
+    if (ch >= ARRAY_SIZE(adc_channels))
+    {
+        return -EINVAL;
+    }
+    return adc_raw_to_microvolts_dt(&adc_channels[ch], val);
+}
+
+int npm_adc_capture(size_t ch, int16_t *mv, size_t count, uint32_t interval_us)
+{
+    int err = npm_adc_capture_raw(ch, mv, count, interval_us);
+    if (err < 0)
+    {
+        return err;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        int32_t val_mv = mv[i];
+
+        err = adc_raw_to_millivolts_dt(&adc_channels[ch], &val_mv);
+        mv[i] = (err < 0) ? -1 : val_mv;
+    }
+    return 0;
+}
+
+#if defined(CONFIG_BENCH)
+
+static volatile int32_t bench_mv;
+
+static int bench_raw_to_mv(void *ctx)
+{
+    int32_t val_mv = BIT(adc_block_sequence.resolution - 1); // mid-scale
+
+    ARG_UNUSED(ctx);
+    int err = adc_raw_to_millivolts_dt(&adc_channels[NPM_ADC_CH_BOOST], &val_mv);
+    bench_mv = val_mv;
+    return err;
+}
+
+static int bench_block_reduce(void *ctx)
+{
+    // a private block, the sampler's buffers may be in use by the DMA
+    static int16_t block[ADC_BLOCK_SAMPLES][ADC_CHANNEL_COUNT];
+    struct adc_sample_msg msg;
+
+    ARG_UNUSED(ctx);
+    adc_block_reduce(block, &msg);
+    bench_mv = msg.channel_mv[0];
+    return 0;
+}
+
+int npm_adc_bench(uint32_t iterations)
+{
+    int err = bench_measure("adc_raw_to_mv", NULL, bench_raw_to_mv, NULL, iterations);
+
+    if (err == 0)
+    {
+        err = bench_measure("adc_block_reduce", NULL, bench_block_reduce, NULL, iterations);
+    }
+    return err;
+}
+
+#endif // CONFIG_BENCH
+
+#if defined(CONFIG_PIPELINE)
+
+int npm_adc_acquire(k_timeout_t timeout)
+{
+    // the pipeline samples synchronously, owning the lock is enough
+    if (k_mutex_lock(&adc_capture_lock, timeout))
+    {
+        return -EAGAIN;
+    }
+
+    int err = rtpm_get(RTPM_SAADC);
+    if (err)
+    {
+        k_mutex_unlock(&adc_capture_lock);
+    }
+    return err;
+}
+
+void npm_adc_release(void)
+{
+    rtpm_put(RTPM_SAADC);
+    k_mutex_unlock(&adc_capture_lock);
+}
+
+// one block sampled back to back, for the pipeline tick
+int npm_adc_step(void)
+{
+    struct adc_sample_msg msg;
+    int err;
+
+    if (k_mutex_lock(&adc_capture_lock, K_NO_WAIT))
+    {
+        LOG_DBG("ADC step skipped, capture in progress");
+        return -EBUSY;
+    }
+
+    adc_block_options.interval_us = 0;
+    adc_block_sequence.buffer = adc_blocks[0];
+
+    // the SAADC is only resumed for the block, it is suspended again before the reduction
+    err = rtpm_get(RTPM_SAADC);
+    if (err == 0)
+    {
+        err = adc_cal_schedule();
+        if (err == 0)
+        {
+            err = adc_read(adc_channels[0].dev, &adc_block_sequence);
+        }
+        rtpm_put(RTPM_SAADC);
+    }
+    if (err < 0)
+    {
+        LOG_ERR("Could not read both channels (%d)", err);
+        adc_cal_needed = true; // recalibrate with the next block
+        msg.channel_mv[0] = -1;
+        msg.channel_mv[1] = -1;
+    }
+    else
+    {
+        counter_inc(COUNTER_ADC_BLOCK);
+        counter_add(COUNTER_ADC_SAMPLE, ADC_BLOCK_SAMPLES);
+        adc_block_reduce(adc_blocks[0], &msg);
+    }
+    k_mutex_unlock(&adc_capture_lock);
+    msg.timestamp = k_uptime_get_32();
+    LOG_INF("ADC step published: Ch0=%d mV, Ch1=%d mV", msg.channel_mv[0], msg.channel_mv[1]);
+    telemetry_publish_adc(&msg);
+
+    return err;
+}
+
+#else
+
+int npm_adc_acquire(k_timeout_t timeout)
+{
+    if (k_mutex_lock(&adc_capture_lock, timeout))
+    {
+        return -EAGAIN;
+    }
+
+    atomic_set(&adc_capture_state, 1);
+    if (k_sem_take(&adc_capture_ready, timeout) != 0)
+    {
+        if (atomic_cas(&adc_capture_state, 1, 0))
+        {
+            // the sampler never looked, nothing to undo
+            k_mutex_unlock(&adc_capture_lock);
+            return -EAGAIN;
         }
+        // the sampler is already stopping, it gives ready right away
+        k_sem_take(&adc_capture_ready, K_FOREVER);
+    }
+
+    // the sampler dropped its reference with its last block, the capture takes its own
+    int err = rtpm_get(RTPM_SAADC);
+    if (err)
+    {
+        atomic_set(&adc_capture_state, 0);
+        k_sem_give(&adc_capture_done);
+        k_mutex_unlock(&adc_capture_lock);
+    }
+    return err;
+}
+
+void npm_adc_release(void)
+{
+    rtpm_put(RTPM_SAADC);
+    atomic_set(&adc_capture_state, 0);
+    k_sem_give(&adc_capture_done);
+    k_mutex_unlock(&adc_capture_lock);
+}
+
+/* Every block holds a SAADC runtime PM reference from its start until it is reduced. A timed block
+ * train overlaps them, so the SAADC only suspends between the short blocks of the slower periods.
+ */
+static int adc_block_next(int16_t (*block)[ADC_CHANNEL_COUNT], uint32_t span_ms)
+{
+    int err = rtpm_get(RTPM_SAADC);
+    if (err < 0)
+    {
+        return err;
+    }
+
+    err = adc_cal_schedule();
+    if (err == 0)
+    {
+        err = adc_block_start(block, span_ms);
+    }
+    if (err < 0)
+    {
+        rtpm_put(RTPM_SAADC);
+    }
+    return err;
+}
+
+/* At the stage's fastest period a block is spread over the whole period by the SAADC timer and the
+ * next one follows at once, so the rails are covered continuously. At slower periods the block is
+ * sampled back to back (span 0) and the rest of the period is spent waiting on the stage's wake
+ * semaphore with the SAADC suspended. The ADC API cannot abort a block, this also bounds how long a
+ * scheduler wake waits for the block in flight to the fastest period.
+ */
+static uint32_t adc_block_span_ms(uint32_t period_ms)
+{
+    uint32_t min_ms;
+    uint32_t max_ms;
+
+    sched_get_limits(SCHED_STAGE_ADC, &min_ms, &max_ms);
+    return (period_ms <= min_ms) ? period_ms : 0;
+}
+
+// Task dedicated to sampling the ADC
+void adc_sample_thread(void)
+{
+    int err;
+    int result;
+    unsigned int signaled;
+    size_t filling = 0;
+    bool in_flight = false;
+    int64_t cycle_start = 0;
+    uint32_t period_ms = sched_period_ms(SCHED_STAGE_ADC);
+    struct adc_sample_msg msg;
+    struct k_sem *wake = sched_wake_sem(SCHED_STAGE_ADC);
+    struct k_poll_event events[2];
+
+    k_poll_event_init(&events[0], K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &adc_block_done);
+    k_poll_event_init(&events[1], K_POLL_TYPE_SEM_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY, wake);
+
+    if (npm_adc_init() < 0)
+    {
+        return;
     }
 
     for (;;)
     {
-        err = adc_read(adc_channels->dev, &sequence);
-        if (err < 0)
+        if (!in_flight)
         {
-            LOG_ERR("Could not read both channels (%d)", err);
+            cycle_start = k_uptime_get();
+            err = adc_block_next(adc_blocks[filling], adc_block_span_ms(period_ms));
+            if (err < 0)
+            {
+                // no block in flight, back off and retry with a fresh calibration, a stale wake must not cut it short
+                LOG_ERR("Could not start ADC sampling (%d)", err);
+                adc_cal_needed = true;
+                k_sem_reset(wake);
+                sched_sleep(SCHED_STAGE_ADC);
+                period_ms = sched_period_ms(SCHED_STAGE_ADC);
+                continue;
+            }
+        }
+
+        // a wake during the block (the stage became hot) skips the rest of the period
+        bool woken = false;
+
+        for (;;)
+        {
+            k_poll(events, ARRAY_SIZE(events), K_FOREVER);
+            if (events[1].state == K_POLL_STATE_SEM_AVAILABLE)
+            {
+                k_sem_reset(wake);
+                woken = true;
+            }
+            events[1].state = K_POLL_STATE_NOT_READY;
+            if (events[0].state == K_POLL_STATE_SIGNALED)
+            {
+                break;
+            }
+        }
+        events[0].state = K_POLL_STATE_NOT_READY;
+        k_poll_signal_check(&adc_block_done, &signaled, &result);
+        in_flight = false;
+
+        uint32_t done_period_ms = period_ms;
+        bool done_full = adc_block_span_ms(done_period_ms) == done_period_ms;
+
+        period_ms = sched_advance(SCHED_STAGE_ADC);
+
+        // a continuous block train hands the next block to the SAADC before touching the finished one
+        bool capture = atomic_cas(&adc_capture_state, 1, 2);
+        size_t done = filling;
+        filling ^= 1;
+        if (!capture && (done_full || woken) && adc_block_span_ms(period_ms) == period_ms)
+        {
+            cycle_start = k_uptime_get();
+            err = adc_block_next(adc_blocks[filling], period_ms);
+            in_flight = (err == 0);
+            if (err < 0)
+            {
+                LOG_ERR("Could not restart ADC sampling (%d)", err); // retried at the top of the loop
+            }
+        }
+
+        if (result < 0)
+        {
+            LOG_ERR("Could not read both channels (%d)", result);
+            adc_cal_needed = true;
+            msg.channel_mv[0] = -1;
+            msg.channel_mv[1] = -1;
         }
         else
         {
-            // Convert raw values to mV for both channels
-            for (size_t i = 0; i < ARRAY_SIZE(adc_channels); i++)
+            counter_inc(COUNTER_ADC_BLOCK);
+            counter_add(COUNTER_ADC_SAMPLE, ADC_BLOCK_SAMPLES);
+            adc_block_reduce(adc_blocks[done], &msg);
+        }
+        rtpm_put(RTPM_SAADC); // the finished block's reference
+        msg.timestamp = k_uptime_get_32();
+        LOG_INF("ADC Thread published: Ch0=%d mV, Ch1=%d mV", msg.channel_mv[0], msg.channel_mv[1]);
+        telemetry_publish_adc(&msg);
+
+        if (capture)
+        {
+            // the SAADC is suspended now, wait for the capture and resume, a capture leaves the calibration alone
+            k_sem_give(&adc_capture_ready);
+            k_sem_take(&adc_capture_done, K_FOREVER);
+        }
+        else if (!in_flight && !woken)
+        {
+            // rest of the finished block's period, ended early when the scheduler wakes the stage
+            int64_t left_ms = done_period_ms - (k_uptime_get() - cycle_start);
+
+            if (left_ms > 0)
             {
-                int32_t val_mv = (int32_t)buf[i]; // You can check buf[i] for a raw sample.
-                err = adc_raw_to_millivolts_dt(&adc_channels[i], &val_mv);
-                msg.channel_mv[i] = (err < 0) ? -1 : val_mv;
+                (void)k_sem_take(wake, K_MSEC(left_ms));
             }
+            period_ms = sched_period_ms(SCHED_STAGE_ADC);
         }
-        LOG_INF("ADC Thread sent: Ch0=%d mV, Ch1=%d mV", msg.channel_mv[0], msg.channel_mv[1]);
-        k_msgq_put(&adc_msgq, &msg, K_FOREVER);
-        k_sleep(ADC_SAMPLE_INTERVAL);
     }
 }
 
 K_THREAD_DEFINE(adc_sample_thread_id, ADC_THREAD_STACK_SIZE, adc_sample_thread, NULL, NULL, NULL, ADC_THREAD_PRIORITY,
-                0, 0);
\ No newline at end of file
+                0, 0);
+
+#endif // CONFIG_PIPELINE
+
+#if defined(CONFIG_SHELL)
+
+static int cmd_adc_cal(const struct shell *sh, size_t argc, char **argv)
+{
+    struct npm_adc_cal_stats st;
+
+    npm_adc_cal_stats(&st);
+    shell_print(sh, "calibrations: %u (startup %u, temperature %u, age %u)", st.count,
+                st.by_reason[NPM_ADC_CAL_STARTUP], st.by_reason[NPM_ADC_CAL_TEMP], st.by_reason[NPM_ADC_CAL_AGE]);
+    shell_print(sh, "cost: last %u us, total %u us", st.last_us, st.total_us);
+    if (st.count)
+    {
+        shell_print(sh, "last: %u ms ago", k_uptime_get_32() - st.last_timestamp);
+    }
+    if (st.temp_valid)
+    {
+        shell_print(sh, "reference die temperature: " CENTI_FMT " C", CENTI_ARGS(st.last_temp));
+    }
+    return 0;
+}
+
+SHELL_CMD_REGISTER(adc_cal, NULL, "SAADC offset calibration count and cost", cmd_adc_cal);
+
+#endif
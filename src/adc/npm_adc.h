@@ -1,10 +1,62 @@
 #ifndef NPM_ADC_H_
 #define NPM_ADC_H_
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <zephyr/kernel.h>
+
+// io-channels order in the devicetree
+#define NPM_ADC_CH_BOOST 0
+#define NPM_ADC_CH_LSLDO 1
+
 struct adc_sample_msg
 {
     int32_t channel_mv[2];
+    uint32_t timestamp; // k_uptime_get_32() when the block completed
+};
+
+// set up both io-channels, called by the sampling thread or the pipeline
+int npm_adc_init(void);
+
+// sample one block synchronously and publish it, CONFIG_PIPELINE only
+int npm_adc_step(void);
+
+/* Exclusive use of the SAADC for captures. The block sampler finishes its current block and
+ * pauses (so telemetry goes stale) until npm_adc_release(). -EAGAIN if it did not stop in time.
+ */
+int npm_adc_acquire(k_timeout_t timeout);
+void npm_adc_release(void);
+
+enum npm_adc_cal_reason
+{
+    NPM_ADC_CAL_STARTUP, // first block, and the first one after a failed read
+    NPM_ADC_CAL_TEMP,    // die temperature moved by CONFIG_NPM_ADC_CAL_TEMP_DELTA
+    NPM_ADC_CAL_AGE,     // CONFIG_NPM_ADC_CAL_MAX_AGE_S since the last one
+    NPM_ADC_CAL_REASON_COUNT,
 };
 
+struct npm_adc_cal_stats
+{
+    uint32_t count; // offset calibrations since boot
+    uint32_t by_reason[NPM_ADC_CAL_REASON_COUNT];
+    uint32_t last_us;        // duration of the last one, calibration plus one sampling
+    uint32_t total_us;       // sum of all durations
+    uint32_t last_timestamp; // k_uptime_get_32() of the last one
+    int16_t last_temp;       // die temperature in 0.01 deg C at the last one, valid if temp_valid
+    bool temp_valid;
+};
+
+// calibration count and cost, see the scheduler in npm_adc.c
+void npm_adc_cal_stats(struct npm_adc_cal_stats *out);
+
+// sample one channel count times, interval_us apart (0: back to back), into mV. Needs npm_adc_acquire().
+int npm_adc_capture(size_t ch, int16_t *mv, size_t count, uint32_t interval_us);
+
+// same as npm_adc_capture() but leaves the raw conversion results, for processing at full resolution
+int npm_adc_capture_raw(size_t ch, int16_t *raw, size_t count, uint32_t interval_us);
+
+// convert a raw conversion result of channel ch to uV in place, the conversion is linear through 0
+int npm_adc_raw_to_uv(size_t ch, int32_t *val);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,246 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * ble_conn_param.c
+ * connection interval and peripheral latency negotiation, follows the reporting period.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#include "ble_conn_param.h"
+
+LOG_MODULE_REGISTER(ble_conn_param, LOG_LEVEL_INF);
+
+#define CONN_INTERVAL_UNITS(ms) ((ms) * 4 / 5) // 1.25 ms units
+#define CONN_INTERVAL_MS(units) ((units) * 5 / 4)
+#define CONN_INTERVAL_MIN_UNITS 6              // 7.5 ms, smallest the spec allows
+#define CONN_INTERVAL_MAX_UNITS 3200           // 4 s, largest the spec allows
+#define CONN_TIMEOUT_MAX_MS 32000
+
+/* Each rejected or ignored request steps down one level:
+ * 0: exact interval and latency for the period
+ * 1: wider interval window, same latency
+ * 2: no latency, let the central pick any interval up to the target
+ * after that the link is left alone until the period changes.
+ */
+enum conn_param_level
+{
+    CONN_PARAM_LEVEL_EXACT,
+    CONN_PARAM_LEVEL_WIDE,
+    CONN_PARAM_LEVEL_NO_LATENCY,
+    CONN_PARAM_LEVEL_COUNT,
+};
+
+// one negotiation per connection, indexed by bt_conn_index()
+struct conn_param_link
+{
+    struct bt_conn *conn;
+    struct k_work_delayable work;
+    uint8_t level;
+    bool pending;
+    struct bt_le_conn_param requested;
+    uint16_t cur_interval;
+    uint16_t cur_latency;
+};
+
+static struct k_spinlock lock;
+static uint32_t period_ms;
+static struct conn_param_link links[CONFIG_BT_MAX_CONN];
+
+// parameters to ask for at a reporting period and fallback level
+static void conn_param_target(uint32_t period, uint8_t lvl, struct bt_le_conn_param *param)
+{
+    // the central should hear from us at least this often, even when reports are slower
+    uint32_t span_ms = MIN(period, CONFIG_BLE_CONN_EVENT_SPAN_MAX_MS);
+    // smallest interval that covers the span within the latency budget, short intervals keep writes responsive
+    uint32_t interval_ms =
+        CLAMP(span_ms / (CONFIG_BLE_CONN_LATENCY_MAX + 1), CONFIG_BLE_CONN_INTERVAL_MIN_MS,
+              CONFIG_BLE_CONN_INTERVAL_MAX_MS);
+    uint16_t interval = MAX(CONN_INTERVAL_UNITS(interval_ms), CONN_INTERVAL_MIN_UNITS);
+    uint16_t latency = CLAMP(span_ms / CONN_INTERVAL_MS(interval), 1, CONFIG_BLE_CONN_LATENCY_MAX + 1) - 1;
+
+    switch (lvl)
+    {
+    case CONN_PARAM_LEVEL_EXACT:
+        param->interval_min = interval;
+        param->interval_max = interval;
+        break;
+    case CONN_PARAM_LEVEL_WIDE:
+        param->interval_min = MAX(interval / 2, CONN_INTERVAL_UNITS(CONFIG_BLE_CONN_INTERVAL_MIN_MS));
+        param->interval_max = MIN(interval + interval / 2, CONN_INTERVAL_MAX_UNITS);
+        break;
+    default:
+        param->interval_min = MAX(CONN_INTERVAL_UNITS(CONFIG_BLE_CONN_INTERVAL_MIN_MS), CONN_INTERVAL_MIN_UNITS);
+        param->interval_max = MAX(interval, param->interval_min);
+        latency = 0;
+        break;
+    }
+    param->latency = latency;
+
+    // the spec wants timeout > 2 * interval_max * (latency + 1), keep margin for missed events
+    uint32_t timeout_ms = MAX(3 * CONN_INTERVAL_MS((uint32_t)param->interval_max) * (latency + 1),
+                              CONFIG_BLE_CONN_SUPERVISION_MIN_MS);
+    param->timeout = MIN(timeout_ms, CONN_TIMEOUT_MAX_MS) / 10;
+}
+
+static bool conn_param_satisfied(const struct bt_le_conn_param *param, uint16_t interval, uint16_t latency)
+{
+    return interval >= param->interval_min && interval <= param->interval_max && latency == param->latency;
+}
+
+static void conn_param_work_handler(struct k_work *work)
+{
+    struct conn_param_link *link =
+        CONTAINER_OF(k_work_delayable_from_work(work), struct conn_param_link, work);
+    struct bt_le_conn_param param;
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (!link->conn)
+    {
+        k_spin_unlock(&lock, key);
+        return;
+    }
+    if (link->pending)
+    {
+        // no matching le_param_updated within the response time, the central rejected or ignored it
+        LOG_WRN("Central %d did not apply interval %u-%u ms latency %u, falling back", (int)(link - links),
+                CONN_INTERVAL_MS(link->requested.interval_min), CONN_INTERVAL_MS(link->requested.interval_max),
+                link->requested.latency);
+        link->pending = false;
+        link->level++;
+    }
+    if (link->level >= CONN_PARAM_LEVEL_COUNT)
+    {
+        k_spin_unlock(&lock, key);
+        LOG_INF("Keeping central %d's connection parameters until the reporting period changes",
+                (int)(link - links));
+        return;
+    }
+
+    conn_param_target(period_ms, link->level, &param);
+    if (conn_param_satisfied(&param, link->cur_interval, link->cur_latency))
+    {
+        k_spin_unlock(&lock, key);
+        return;
+    }
+
+    struct bt_conn *conn = bt_conn_ref(link->conn);
+    uint32_t period = period_ms;
+    link->requested = param;
+    link->pending = true;
+    k_spin_unlock(&lock, key);
+
+    LOG_INF("Requesting interval %u-%u ms, latency %u, timeout %u ms for a %u ms period",
+            CONN_INTERVAL_MS(param.interval_min), CONN_INTERVAL_MS(param.interval_max), param.latency,
+            param.timeout * 10, period);
+    int err = bt_conn_le_param_update(conn, &param);
+    bt_conn_unref(conn);
+
+    key = k_spin_lock(&lock);
+    if (err == -EALREADY)
+    {
+        // the link already runs with these values
+        link->pending = false;
+    }
+    else if (err)
+    {
+        LOG_ERR("bt_conn_le_param_update() returned %d", err);
+        link->pending = false;
+        link->level++;
+        k_work_reschedule(&link->work, K_SECONDS(CONFIG_BLE_CONN_PARAM_HOLDOFF_S));
+    }
+    else
+    {
+        k_work_reschedule(&link->work, K_SECONDS(CONFIG_BLE_CONN_PARAM_RSP_TIMEOUT_S));
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void ble_conn_param_connected(struct bt_conn *conn, uint32_t period)
+{
+    struct conn_param_link *link = &links[bt_conn_index(conn)];
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    link->conn = conn;
+    period_ms = period;
+    link->level = CONN_PARAM_LEVEL_EXACT;
+    link->pending = false;
+    // give the PHY, data length and MTU procedures a head start
+    k_work_reschedule(&link->work, K_SECONDS(CONFIG_BLE_CONN_PARAM_HOLDOFF_S));
+    k_spin_unlock(&lock, key);
+}
+
+void ble_conn_param_disconnected(struct bt_conn *conn)
+{
+    struct conn_param_link *link = &links[bt_conn_index(conn)];
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    link->conn = NULL;
+    link->pending = false;
+    k_work_cancel_delayable(&link->work);
+    k_spin_unlock(&lock, key);
+}
+
+void ble_conn_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+    struct conn_param_link *link = &links[bt_conn_index(conn)];
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    link->cur_interval = interval;
+    link->cur_latency = latency;
+    if (link->pending)
+    {
+        link->pending = false;
+        k_work_cancel_delayable(&link->work);
+        if (conn_param_satisfied(&link->requested, interval, latency))
+        {
+            k_spin_unlock(&lock, key);
+            LOG_INF("Connection parameters applied: interval %u ms, latency %u, timeout %u ms",
+                    CONN_INTERVAL_MS(interval), latency, timeout * 10);
+            return;
+        }
+        // the central answered with its own values, accept them rather than ping-pong
+        link->level = CONN_PARAM_LEVEL_COUNT;
+    }
+    k_spin_unlock(&lock, key);
+    LOG_INF("Connection parameters from central: interval %u ms, latency %u, timeout %u ms",
+            CONN_INTERVAL_MS(interval), latency, timeout * 10);
+}
+
+void ble_conn_param_set_period(uint32_t period)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (period != period_ms)
+    {
+        period_ms = period;
+        for (size_t i = 0; i < ARRAY_SIZE(links); i++)
+        {
+            links[i].level = CONN_PARAM_LEVEL_EXACT;
+            links[i].pending = false;
+            if (links[i].conn)
+            {
+                // the scheduler ramps in steps, wait for it to settle before asking again
+                k_work_reschedule(&links[i].work, K_SECONDS(CONFIG_BLE_CONN_PARAM_HOLDOFF_S));
+            }
+        }
+    }
+    k_spin_unlock(&lock, key);
+}
+
+static int ble_conn_param_init(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(links); i++)
+    {
+        k_work_init_delayable(&links[i].work, conn_param_work_handler);
+    }
+
+    return 0;
+}
+
+SYS_INIT(ble_conn_param_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,21 @@
+#ifndef BLE_CONN_PARAM_H_
+#define BLE_CONN_PARAM_H_
+
+#include <stdint.h>
+#include <zephyr/bluetooth/conn.h>
+
+/* Connection parameter manager. Asks each central for an interval and peripheral latency
+ * that match the reporting period, so idle connection events are skipped between reports.
+ */
+
+// start managing a new connection, period_ms is the current reporting period
+void ble_conn_param_connected(struct bt_conn *conn, uint32_t period_ms);
+void ble_conn_param_disconnected(struct bt_conn *conn);
+
+// to be called from le_param_updated with the values in controller units
+void ble_conn_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency, uint16_t timeout);
+
+// report the current reporting period, a change re-negotiates after a hold-off
+void ble_conn_param_set_period(uint32_t period_ms);
+
+#endif
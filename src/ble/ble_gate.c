@@ -0,0 +1,104 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * ble_gate.c
+ * deadband and heartbeat filter that decides which characteristics are notified.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "ble_gate.h"
+
+// which signals each characteristic carries
+static const uint8_t gate_signals[BLE_GATE_COUNT] = {
+    [BLE_GATE_RD_ALL] = BIT_MASK(BLE_SIGNAL_COUNT),
+    [BLE_GATE_BOOST] = BIT(BLE_SIGNAL_BOOST_MV),
+    [BLE_GATE_LSLDO] = BIT(BLE_SIGNAL_LSLDO_MV),
+    [BLE_GATE_BATT] = BIT(BLE_SIGNAL_SOC),
+};
+
+// written from the BT RX thread through the Config characteristic, read by the BLE thread
+static atomic_t deadband[BLE_SIGNAL_COUNT] = {
+    [BLE_SIGNAL_BOOST_MV] = ATOMIC_INIT(CONFIG_BLE_DEADBAND_BOOST_MV),
+    [BLE_SIGNAL_LSLDO_MV] = ATOMIC_INIT(CONFIG_BLE_DEADBAND_LSLDO_MV),
+    [BLE_SIGNAL_SOC] = ATOMIC_INIT(CONFIG_BLE_DEADBAND_SOC),
+    [BLE_SIGNAL_VBAT_MV] = ATOMIC_INIT(CONFIG_BLE_DEADBAND_VBAT_MV),
+    [BLE_SIGNAL_TEMP] = ATOMIC_INIT(CONFIG_BLE_DEADBAND_TEMP),
+};
+
+static atomic_t heartbeat_s[BLE_GATE_COUNT] = {
+    [0 ... BLE_GATE_COUNT - 1] = ATOMIC_INIT(CONFIG_BLE_HEARTBEAT_S),
+};
+
+bool ble_gate_due(const struct ble_gates *gates, enum ble_gate_id gate, const int32_t values[BLE_SIGNAL_COUNT],
+                  int64_t now)
+{
+    uint32_t heartbeat_ms = (uint32_t)atomic_get(&heartbeat_s[gate]) * MSEC_PER_SEC;
+
+    if (!gates->gate[gate].primed)
+    {
+        return true;
+    }
+    if (heartbeat_ms && (now - gates->gate[gate].last_sent) >= heartbeat_ms)
+    {
+        return true;
+    }
+
+    for (size_t i = 0; i < BLE_SIGNAL_COUNT; i++)
+    {
+        if (!(gate_signals[gate] & BIT(i)))
+        {
+            continue;
+        }
+
+        uint32_t band = (uint32_t)atomic_get(&deadband[i]);
+        uint32_t delta = (uint32_t)abs(values[i] - gates->gate[gate].last[i]);
+
+        if (band == 0 || delta >= band)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ble_gate_sent(struct ble_gates *gates, enum ble_gate_id gate, const int32_t values[BLE_SIGNAL_COUNT],
+                   int64_t now)
+{
+    memcpy(gates->gate[gate].last, values, sizeof(gates->gate[gate].last));
+    gates->gate[gate].last_sent = now;
+    gates->gate[gate].primed = true;
+}
+
+void ble_gate_reset(struct ble_gates *gates)
+{
+    for (size_t i = 0; i < BLE_GATE_COUNT; i++)
+    {
+        gates->gate[i].primed = false;
+    }
+}
+
+uint32_t ble_gate_deadband(enum ble_signal signal)
+{
+    return (uint32_t)atomic_get(&deadband[signal]);
+}
+
+void ble_gate_set_deadband(enum ble_signal signal, uint32_t band)
+{
+    atomic_set(&deadband[signal], (atomic_val_t)band);
+}
+
+uint32_t ble_gate_heartbeat_s(enum ble_gate_id gate)
+{
+    return (uint32_t)atomic_get(&heartbeat_s[gate]);
+}
+
+void ble_gate_set_heartbeat_s(enum ble_gate_id gate, uint32_t seconds)
+{
+    atomic_set(&heartbeat_s[gate], (atomic_val_t)seconds);
+}
@@ -0,0 +1,57 @@
+#ifndef BLE_GATE_H_
+#define BLE_GATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Change-driven notifications. A characteristic is notified only when one of its values moved
+ * by at least that value's deadband since the last notification, or when its heartbeat expired.
+ */
+enum ble_signal
+{
+    BLE_SIGNAL_BOOST_MV,
+    BLE_SIGNAL_LSLDO_MV,
+    BLE_SIGNAL_SOC,     // 0.01 %
+    BLE_SIGNAL_VBAT_MV,
+    BLE_SIGNAL_TEMP,    // 0.01 deg C
+    BLE_SIGNAL_COUNT,
+};
+
+enum ble_gate_id
+{
+    BLE_GATE_RD_ALL, // every signal
+    BLE_GATE_BOOST,
+    BLE_GATE_LSLDO,
+    BLE_GATE_BATT,
+    BLE_GATE_COUNT,
+};
+
+// what was last sent to one receiver, each central keeps its own set
+struct ble_gates
+{
+    struct
+    {
+        int32_t last[BLE_SIGNAL_COUNT];
+        int64_t last_sent;
+        bool primed;
+    } gate[BLE_GATE_COUNT];
+};
+
+// true if the characteristic should be notified with these values
+bool ble_gate_due(const struct ble_gates *gates, enum ble_gate_id gate, const int32_t values[BLE_SIGNAL_COUNT],
+                  int64_t now);
+
+// record a delivered (or queued) notification, the next deadband check is against these values
+void ble_gate_sent(struct ble_gates *gates, enum ble_gate_id gate, const int32_t values[BLE_SIGNAL_COUNT],
+                   int64_t now);
+
+// forget what was sent, e.g. for a new connection, so every characteristic goes out once
+void ble_gate_reset(struct ble_gates *gates);
+
+// a deadband of 0 notifies every new sample, a heartbeat of 0 disables it
+uint32_t ble_gate_deadband(enum ble_signal signal);
+void ble_gate_set_deadband(enum ble_signal signal, uint32_t deadband);
+uint32_t ble_gate_heartbeat_s(enum ble_gate_id gate);
+void ble_gate_set_heartbeat_s(enum ble_gate_id gate, uint32_t heartbeat_s);
+
+#endif
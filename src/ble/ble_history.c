@@ -0,0 +1,148 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * ble_history.c
+ * fixed-size RAM ring of timestamped samples waiting to be sent over BLE.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#include "ble_history.h"
+
+LOG_MODULE_REGISTER(ble_history, LOG_LEVEL_INF);
+
+static struct ble_record history[CONFIG_BLE_HISTORY_DEPTH];
+static uint32_t sent_map[DIV_ROUND_UP(CONFIG_BLE_HISTORY_DEPTH, 32)]; // entry reached at least one central
+static uint32_t next_seq;  // sequence number of the next push
+static uint32_t delivered; // everything before this reached at least one central
+static uint32_t unread_lost;
+static struct k_spinlock history_lock;
+
+// must be called with history_lock held
+static uint32_t history_oldest(void)
+{
+    return (next_seq > ARRAY_SIZE(history)) ? next_seq - ARRAY_SIZE(history) : 0;
+}
+
+// must be called with history_lock held
+static bool history_sent(uint32_t seq)
+{
+    size_t slot = seq % ARRAY_SIZE(history);
+
+    return (sent_map[slot / 32] & BIT(slot % 32)) != 0;
+}
+
+// must be called with history_lock held
+static void history_mark(uint32_t seq, bool sent)
+{
+    size_t slot = seq % ARRAY_SIZE(history);
+
+    WRITE_BIT(sent_map[slot / 32], slot % 32, sent);
+}
+
+// must be called with history_lock held, moves delivered up to the oldest entry nobody received
+static void history_settle(void)
+{
+    while (delivered < next_seq && history_sent(delivered))
+    {
+        delivered++;
+    }
+}
+
+void ble_history_push(const struct ble_record *rec)
+{
+    k_spinlock_key_t key = k_spin_lock(&history_lock);
+
+    history[next_seq % ARRAY_SIZE(history)] = *rec;
+    history_mark(next_seq, false);
+    next_seq++;
+    if (delivered < history_oldest())
+    {
+        // nobody got the sample that was just overwritten
+        delivered = history_oldest();
+        unread_lost++;
+        history_settle();
+    }
+
+    k_spin_unlock(&history_lock, key);
+}
+
+uint32_t ble_history_undelivered(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&history_lock);
+    uint32_t seq = delivered;
+    uint32_t lost = unread_lost;
+
+    unread_lost = 0;
+    k_spin_unlock(&history_lock, key);
+
+    if (lost)
+    {
+        LOG_WRN("History ring overflowed, %u oldest samples were lost", lost);
+    }
+    return seq;
+}
+
+size_t ble_history_read(uint32_t *cursor, struct ble_record *recs, size_t max)
+{
+    k_spinlock_key_t key = k_spin_lock(&history_lock);
+    uint32_t oldest = history_oldest();
+    uint32_t behind = 0;
+
+    if (*cursor < oldest)
+    {
+        behind = oldest - *cursor;
+        *cursor = oldest;
+    }
+
+    size_t n = MIN(max, (size_t)(next_seq - *cursor));
+
+    for (size_t i = 0; i < n; i++)
+    {
+        recs[i] = history[(*cursor + i) % ARRAY_SIZE(history)];
+    }
+
+    k_spin_unlock(&history_lock, key);
+
+    if (behind)
+    {
+        LOG_WRN("Central fell behind the history ring, %u samples skipped", behind);
+    }
+    return n;
+}
+
+void ble_history_advance(uint32_t *cursor, size_t n)
+{
+    k_spinlock_key_t key = k_spin_lock(&history_lock);
+    uint32_t end = MIN(*cursor + n, next_seq);
+
+    for (uint32_t seq = MAX(*cursor, history_oldest()); seq < end; seq++)
+    {
+        history_mark(seq, true);
+    }
+    *cursor = end;
+    history_settle();
+
+    k_spin_unlock(&history_lock, key);
+}
+
+void ble_history_skip(uint32_t *cursor, size_t n)
+{
+    k_spinlock_key_t key = k_spin_lock(&history_lock);
+
+    *cursor = MIN(*cursor + n, next_seq);
+
+    k_spin_unlock(&history_lock, key);
+}
+
+size_t ble_history_pending(uint32_t cursor)
+{
+    k_spinlock_key_t key = k_spin_lock(&history_lock);
+    size_t n = (cursor < next_seq) ? next_seq - cursor : 0;
+
+    k_spin_unlock(&history_lock, key);
+    return n;
+}
@@ -0,0 +1,34 @@
+#ifndef BLE_HISTORY_H_
+#define BLE_HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ble_record.h"
+
+/* Every sample gets a sequence number. Each central reads from its own cursor (the sequence
+ * number of the next sample it needs), so a slow central only holds up itself. The ring keeps
+ * the newest CONFIG_BLE_HISTORY_DEPTH samples whoever has read them.
+ */
+
+// append a sample, the oldest entry is overwritten when the ring is full
+void ble_history_push(const struct ble_record *rec);
+
+// where a new central starts: the oldest sample no central has received yet, entries a central
+// skipped count as not received
+uint32_t ble_history_undelivered(void);
+
+// copy up to max entries from *cursor on, returns the number copied.
+// a cursor that fell behind the ring is moved up to the oldest entry still there.
+size_t ble_history_read(uint32_t *cursor, struct ble_record *recs, size_t max);
+
+// move the cursor past n entries once they have been delivered
+void ble_history_advance(uint32_t *cursor, size_t n);
+
+// move the cursor past n entries this central does not need, they stay undelivered for the others
+void ble_history_skip(uint32_t *cursor, size_t n);
+
+// entries from cursor to the newest
+size_t ble_history_pending(uint32_t cursor);
+
+#endif
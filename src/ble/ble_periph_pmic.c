@@ -28,8 +28,21 @@
 #include <dk_buttons_and_leds.h>
 
 #include "ble_periph_pmic.h"
+#include "adc_burst.h"
+#include "bench.h"
+#include "ble_conn_param.h"
+#include "ble_gate.h"
+#include "ble_history.h"
+#include "ble_record.h"
+#include "diag.h"
+#include "fixed_point.h"
+#include "lsldo_profile.h"
+#include "pipeline.h"
+#include "counters.h"
 #include "npm_adc.h"
 #include "pmic.h"
+#include "sched.h"
+#include "telemetry.h"
 #include "threads.h"
 #include "tsync.h"
 
@@ -39,11 +52,16 @@ K_SEM_DEFINE(sem_ble_ready, 0, 1);
 
 #define BLE_STATE_LED DK_LED2
 
-#define BLE_NOTIFY_INTERVAL K_MSEC(1000)
 #define BLE_THREAD_STACK_SIZE 1024
 #define BLE_THREAD_PRIORITY 5
 
-#define MAXLEN CONFIG_BT_CTLR_DATA_LENGTH_MAX - 4
+#define MAXLEN (CONFIG_BT_BUF_ACL_TX_SIZE - 4)
+
+#if defined(CONFIG_BLE_BATCH)
+#define BLE_BATCH_FLUSH_INTERVAL_MS (CONFIG_BLE_BATCH_FLUSH_INTERVAL_S * MSEC_PER_SEC)
+#else
+#define BLE_BATCH_FLUSH_INTERVAL_MS 0
+#endif
 
 #define BT_UUID_PMIC_HUB BT_UUID_DECLARE_128(PMIC_HUB_SERVICE_UUID)
 #define BT_UUID_PMIC_HUB_RD_ALL BT_UUID_DECLARE_128(PMIC_RD_ALL_CHARACTERISTIC_UUID)
@@ -51,6 +69,19 @@ K_SEM_DEFINE(sem_ble_ready, 0, 1);
 #define BT_UUID_PMIC_HUB_LSLDO_RD_MV BT_UUID_DECLARE_128(LSLDO_RD_MV_CHARACTERISTIC_UUID)
 #define BT_UUID_PMIC_HUB_LSLDO_WR_MV BT_UUID_DECLARE_128(LSLDO_WR_MV_CHARACTERISTIC_UUID)
 #define BT_UUID_PMIC_HUB_BATT_RD BT_UUID_DECLARE_128(BATT_RD_CHARACTERISTIC_UUID)
+#define BT_UUID_PMIC_HUB_CFG_RW BT_UUID_DECLARE_128(CFG_RW_CHARACTERISTIC_UUID)
+#define BT_UUID_PMIC_HUB_DIAG_RD BT_UUID_DECLARE_128(DIAG_RD_CHARACTERISTIC_UUID)
+#define BT_UUID_PMIC_HUB_COUNTERS_RW BT_UUID_DECLARE_128(COUNTERS_RW_CHARACTERISTIC_UUID)
+#define BT_UUID_PMIC_HUB_BURST_RW BT_UUID_DECLARE_128(BURST_RW_CHARACTERISTIC_UUID)
+
+#define BLE_HEARTBEAT_MAX_S 86400
+
+#define DIAG_MAXLEN 320 // served with long reads
+
+// period the link has to keep up with, used to pick the connection interval and latency
+#define BLE_REPORT_PERIOD_MS() MAX(sched_period_ms(SCHED_STAGE_NOTIFY), BLE_BATCH_FLUSH_INTERVAL_MS)
+
+#define BLE_ADV_INTERVAL_MS 500 // matches the adv_param interval below
 
 #define DEVICE_NAME CONFIG_BT_DEVICE_NAME // from prj.conf
 #define DEVICE_NAME_LEN (sizeof(DEVICE_NAME) - 1)
@@ -62,10 +93,40 @@ static const struct bt_le_adv_param *adv_param =
                     801,   /* Max Advertising Interval 500.625ms (801*0.625ms) 16384 max*/
                     NULL); /* Set to NULL for undirected advertising */
 
+#if defined(CONFIG_BLE_ADV_TELEMETRY)
+// same interval without the connectable option, keeps the record on air while every slot is taken
+static const struct bt_le_adv_param *adv_param_nconn = BT_LE_ADV_PARAM(BT_LE_ADV_OPT_USE_IDENTITY, 800, 801, NULL);
+#endif
+
 static struct k_work adv_work;
+
+// what the legacy advertising set was last started as, only touched from the system workqueue
+enum ble_adv_mode
+{
+    BLE_ADV_OFF,
+    BLE_ADV_CONN,  // connectable, the stack stops it when a central connects
+    BLE_ADV_NCONN, // non-connectable record only, while all CONFIG_BT_MAX_CONN slots are taken
+};
+static enum ble_adv_mode adv_mode;
+
+#if defined(CONFIG_BLE_ADV_TELEMETRY)
+// only touched from the system workqueue, like the advertising start
+static uint8_t adv_mfg_data[BLE_ADV_RECORD_LEN];
+#define BLE_ADV_MFG_AD_LEN (2 + BLE_ADV_RECORD_LEN)
+#else
+#define BLE_ADV_MFG_AD_LEN 0
+#endif
+
+// flags (3 bytes) and the telemetry record leave this much for the name, it is shortened if needed
+#define BLE_ADV_NAME_MAX (BT_GAP_ADV_MAX_ADV_DATA_LEN - 3 - BLE_ADV_MFG_AD_LEN - 2)
+#define BLE_ADV_NAME_TYPE ((DEVICE_NAME_LEN > BLE_ADV_NAME_MAX) ? BT_DATA_NAME_SHORTENED : BT_DATA_NAME_COMPLETE)
+
 static const struct bt_data ad[] = {
     BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
-    BT_DATA(BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN),
+    BT_DATA(BLE_ADV_NAME_TYPE, DEVICE_NAME, MIN(DEVICE_NAME_LEN, BLE_ADV_NAME_MAX)),
+#if defined(CONFIG_BLE_ADV_TELEMETRY)
+    BT_DATA(BT_DATA_MANUFACTURER_DATA, adv_mfg_data, sizeof(adv_mfg_data)),
+#endif
 };
 
 static const struct bt_data sd[] = {
@@ -74,10 +135,16 @@ static const struct bt_data sd[] = {
 
 void on_le_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency, uint16_t timeout)
 {
-    double connection_interval = interval * 1.25; // in ms
-    uint16_t supervision_timeout = timeout * 10;  // in ms
-    LOG_INF("Connection parameters updated: interval %.2f ms, latency %d intervals, timeout %d ms", connection_interval,
-            latency, supervision_timeout);
+    uint32_t connection_interval = interval * 125; // in 0.01 ms
+    uint16_t supervision_timeout = timeout * 10;   // in ms
+    LOG_INF("Connection parameters updated: interval " CENTI_FMT " ms, latency %d intervals, timeout %d ms",
+            CENTI_ARGS(connection_interval), latency, supervision_timeout);
+    counters_set_radio_state(COUNTERS_RADIO_SLOT_LINK(bt_conn_index(conn)), COUNTERS_RADIO_CONNECTED, interval * 5 / 4,
+                             latency);
+    if (IS_ENABLED(CONFIG_BLE_CONN_PARAM))
+    {
+        ble_conn_param_updated(conn, interval, latency, timeout);
+    }
 }
 
 void on_le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
@@ -106,6 +173,90 @@ void on_le_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_inf
     LOG_INF("Data length updated. Length %d/%d bytes, time %d/%d us", tx_len, rx_len, tx_time, rx_time);
 }
 
+// telemetry characteristics, notified and readable
+enum ble_char
+{
+    BLE_CHAR_RD_ALL,
+    BLE_CHAR_BOOST,
+    BLE_CHAR_LSLDO,
+    BLE_CHAR_BATT,
+    BLE_CHAR_COUNT,
+};
+
+enum ble_link_flag
+{
+    BLE_LINK_CATCH_UP,   // send the queued history as soon as the central subscribes
+    BLE_LINK_GATE_RESET, // send every characteristic once on a new connection, changed or not
+};
+
+// per central state, indexed by bt_conn_index()
+struct ble_link
+{
+    struct bt_conn *conn;
+    atomic_t flags;     // enum ble_link_flag
+    atomic_t in_flight; // notifications handed to the stack and not sent yet
+    uint32_t deferred;  // notifications held back by flow control
+    uint32_t cursor;    // next history sample this central needs
+    int64_t last_flush;
+    struct ble_gates gates;
+    struct bt_gatt_exchange_params exchange_params;
+    uint8_t read_value[MAXLEN]; // telemetry read in progress, kept across a long read
+    uint16_t read_len;
+};
+
+// conn is written by the BT RX thread, everything else belongs to the publisher while conn is set
+static struct ble_link links[CONFIG_BT_MAX_CONN];
+static struct k_spinlock links_lock;
+
+static bool ble_any_subscribed(struct bt_conn *conn);
+static void ble_fill_record(struct ble_record *rec, const struct adc_sample_msg *adc_msg,
+                            const struct pmic_report_msg *pmic_msg);
+static int ble_encode_text(uint8_t *buf, size_t size, const struct adc_sample_msg *adc_msg,
+                           const struct pmic_report_msg *pmic_msg);
+
+// returns a new reference to the connection in slot i, NULL if the slot is free
+static struct bt_conn *ble_link_conn(size_t i)
+{
+    k_spinlock_key_t key = k_spin_lock(&links_lock);
+    struct bt_conn *conn = links[i].conn ? bt_conn_ref(links[i].conn) : NULL;
+
+    k_spin_unlock(&links_lock, key);
+    return conn;
+}
+
+static size_t ble_links_count(void)
+{
+    size_t count = 0;
+    k_spinlock_key_t key = k_spin_lock(&links_lock);
+
+    for (size_t i = 0; i < ARRAY_SIZE(links); i++)
+    {
+        count += (links[i].conn != NULL);
+    }
+    k_spin_unlock(&links_lock, key);
+    return count;
+}
+
+// the scheduler runs everything at full rate only while someone listens
+static void ble_links_update_sched(void)
+{
+    bool connected = false;
+    bool subscribed = false;
+
+    for (size_t i = 0; i < ARRAY_SIZE(links); i++)
+    {
+        struct bt_conn *conn = ble_link_conn(i);
+
+        if (conn)
+        {
+            connected = true;
+            subscribed = subscribed || ble_any_subscribed(conn);
+            bt_conn_unref(conn);
+        }
+    }
+    sched_set_link(connected, subscribed);
+}
+
 /*This function is called whenever the Client Characteristic Control Descriptor
 (CCCD) has been changed by the GATT client, for each of the characteristics*/
 static void on_cccd_changed(const struct bt_gatt_attr *attr, uint16_t value)
@@ -120,6 +271,138 @@ static void on_cccd_changed(const struct bt_gatt_attr *attr, uint16_t value)
     default:
         LOG_ERR("Error, CCCD has been set to an invalid value");
     }
+    ble_links_update_sched();
+}
+
+static const struct
+{
+    enum ble_cfg_key key;
+    enum sched_stage stage;
+    bool is_max;
+} ble_cfg_periods[] = {
+    {BLE_CFG_FG_PERIOD_MIN_MS, SCHED_STAGE_FG, false},
+    {BLE_CFG_FG_PERIOD_MAX_MS, SCHED_STAGE_FG, true},
+    {BLE_CFG_ADC_PERIOD_MIN_MS, SCHED_STAGE_ADC, false},
+    {BLE_CFG_ADC_PERIOD_MAX_MS, SCHED_STAGE_ADC, true},
+    {BLE_CFG_NOTIFY_PERIOD_MIN_MS, SCHED_STAGE_NOTIFY, false},
+    {BLE_CFG_NOTIFY_PERIOD_MAX_MS, SCHED_STAGE_NOTIFY, true},
+};
+
+static const struct
+{
+    enum ble_cfg_key key;
+    bool is_heartbeat; // idx is an enum ble_gate_id, otherwise an enum ble_signal
+    uint8_t idx;
+} ble_cfg_gates[] = {
+    {BLE_CFG_BOOST_DEADBAND_MV, false, BLE_SIGNAL_BOOST_MV},
+    {BLE_CFG_LSLDO_DEADBAND_MV, false, BLE_SIGNAL_LSLDO_MV},
+    {BLE_CFG_SOC_DEADBAND, false, BLE_SIGNAL_SOC},
+    {BLE_CFG_VBAT_DEADBAND_MV, false, BLE_SIGNAL_VBAT_MV},
+    {BLE_CFG_TEMP_DEADBAND, false, BLE_SIGNAL_TEMP},
+    {BLE_CFG_RD_ALL_HEARTBEAT_S, true, BLE_GATE_RD_ALL},
+    {BLE_CFG_BOOST_HEARTBEAT_S, true, BLE_GATE_BOOST},
+    {BLE_CFG_LSLDO_HEARTBEAT_S, true, BLE_GATE_LSLDO},
+    {BLE_CFG_BATT_HEARTBEAT_S, true, BLE_GATE_BATT},
+};
+
+// entry i of the deadband/heartbeat table
+static uint32_t ble_cfg_gate_get(size_t i)
+{
+    return ble_cfg_gates[i].is_heartbeat ? ble_gate_heartbeat_s(ble_cfg_gates[i].idx)
+                                         : ble_gate_deadband(ble_cfg_gates[i].idx);
+}
+
+// fn called when the cfg characteristic is read, returns all entries as key/value pairs
+static ssize_t on_read_cfg(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, uint16_t len,
+                           uint16_t offset)
+{
+    uint8_t value[(ARRAY_SIZE(ble_cfg_periods) + ARRAY_SIZE(ble_cfg_gates)) * BLE_CFG_ENTRY_LEN];
+    uint8_t *entry = value;
+    uint32_t min_ms, max_ms;
+
+    for (size_t i = 0; i < ARRAY_SIZE(ble_cfg_periods); i++, entry += BLE_CFG_ENTRY_LEN)
+    {
+        sched_get_limits(ble_cfg_periods[i].stage, &min_ms, &max_ms);
+        entry[0] = ble_cfg_periods[i].key;
+        sys_put_le32(ble_cfg_periods[i].is_max ? max_ms : min_ms, &entry[1]);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(ble_cfg_gates); i++, entry += BLE_CFG_ENTRY_LEN)
+    {
+        entry[0] = ble_cfg_gates[i].key;
+        sys_put_le32(ble_cfg_gate_get(i), &entry[1]);
+    }
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, value, sizeof(value));
+}
+
+// fn called when the cfg characteristic has been written to by a client
+static ssize_t on_receive_cfg_wr(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *buf,
+                                 uint16_t len, uint16_t offset, uint8_t flags)
+{
+    const uint8_t *buffer = buf;
+    uint32_t min_ms, max_ms;
+
+    if (offset != 0)
+    {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+    if (len != BLE_CFG_ENTRY_LEN)
+    {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    uint8_t key = buffer[0];
+    uint32_t value = sys_get_le32(&buffer[1]);
+
+    for (size_t i = 0; i < ARRAY_SIZE(ble_cfg_periods); i++)
+    {
+        if (ble_cfg_periods[i].key != key)
+        {
+            continue;
+        }
+
+        sched_get_limits(ble_cfg_periods[i].stage, &min_ms, &max_ms);
+        if (ble_cfg_periods[i].is_max)
+        {
+            max_ms = value;
+        }
+        else
+        {
+            min_ms = value;
+        }
+        if (sched_set_limits(ble_cfg_periods[i].stage, min_ms, max_ms))
+        {
+            LOG_ERR("cfg key 0x%02X rejected, %u ms is out of range", key, value);
+            return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+        }
+        return len;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(ble_cfg_gates); i++)
+    {
+        if (ble_cfg_gates[i].key != key)
+        {
+            continue;
+        }
+
+        if (ble_cfg_gates[i].is_heartbeat)
+        {
+            if (value > BLE_HEARTBEAT_MAX_S)
+            {
+                LOG_ERR("cfg key 0x%02X rejected, %u s is out of range", key, value);
+                return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+            }
+            ble_gate_set_heartbeat_s(ble_cfg_gates[i].idx, value);
+        }
+        else
+        {
+            ble_gate_set_deadband(ble_cfg_gates[i].idx, value);
+        }
+        return len;
+    }
+
+    LOG_ERR("unknown cfg key 0x%02X", key);
+    return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
 }
 
 // fn called when lsldo wr characteristic has been written to by a client
@@ -136,6 +419,21 @@ static ssize_t on_receive_lsldo_wr(struct bt_conn *conn, const struct bt_gatt_at
     }
     printk("\n");
 
+#if defined(CONFIG_LSLDO_PROFILE)
+    if (len > 0 && buffer[0] == LSLDO_PROFILE_WR_TAG)
+    {
+        struct lsldo_segment segs[CONFIG_LSLDO_PROFILE_MAX_SEGMENTS];
+        int count = lsldo_profile_decode(buffer, len, segs, ARRAY_SIZE(segs));
+
+        if (count < 0 || lsldo_profile_submit(segs, count))
+        {
+            LOG_ERR("lsldo profile rejected");
+            return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+        }
+        return len;
+    }
+#endif
+
     // We can't write values bigger than 3000 mV. Just look at the first two bytes.
     // The nRF Connect for Mobile app will truncate 800/900 as byte arrays to 80/90 single send.
     if(len>1)
@@ -157,11 +455,187 @@ static ssize_t on_receive_lsldo_wr(struct bt_conn *conn, const struct bt_gatt_at
     else
     {
         k_msgq_put(&ble_cfg_pmic_msgq, &requested_lsldo_mv, K_NO_WAIT);
+        if (IS_ENABLED(CONFIG_PIPELINE))
+        {
+            pipeline_submit_setpoint();
+        }
+        if (IS_ENABLED(CONFIG_DIAG))
+        {
+            diag_msgq_sample(DIAG_MSGQ_BLE_CFG_PMIC, &ble_cfg_pmic_msgq);
+        }
     }
 
     return len;
 }
 
+// value of a telemetry characteristic from the latest snapshot, followed by its age
+static uint16_t ble_encode_read(enum ble_char chr, uint8_t *buf, size_t size)
+{
+    struct telemetry_snapshot snap;
+    struct ble_record rec;
+    uint32_t now = k_uptime_get_32();
+    uint16_t len = 0;
+
+    // seqlock read of the shared snapshot, nothing is queued or waited for
+    telemetry_read(&snap);
+    if (snap.adc_gen == 0 || snap.pmic_gen == 0)
+    {
+        return 0; // nothing sampled yet
+    }
+
+    uint32_t adc_age = now - snap.adc.timestamp;
+    uint32_t pmic_age = now - snap.pmic.timestamp;
+
+    switch (chr)
+    {
+    case BLE_CHAR_BOOST:
+    case BLE_CHAR_LSLDO:
+        sys_put_le32((uint32_t)snap.adc.channel_mv[chr == BLE_CHAR_LSLDO], &buf[0]);
+        sys_put_le32(adc_age, &buf[4]);
+        return 8;
+    case BLE_CHAR_BATT:
+        sys_put_le32(snap.pmic.soc / 100, &buf[0]);
+        sys_put_le32(pmic_age, &buf[4]);
+        return 8;
+    default:
+        break;
+    }
+
+    // RD ALL, the age is the one of the older section
+    if (IS_ENABLED(CONFIG_BLE_REPORT_FORMAT_TEXT))
+    {
+        int n = ble_encode_text(buf, size, &snap.adc, &snap.pmic);
+        if (n >= 0 && (size_t)n < size)
+        {
+            n += snprintf((char *)&buf[n], size - n, " , AGE: %ums", MAX(adc_age, pmic_age));
+        }
+        return (n >= 0 && (size_t)n < size) ? n : 0;
+    }
+    ble_fill_record(&rec, &snap.adc, &snap.pmic);
+    rec.flags = BLE_RECORD_FLAG_READ;
+    len = ble_record_encode(&rec, buf);
+    sys_put_le32(MAX(adc_age, pmic_age), &buf[len]);
+    return len + 4;
+}
+
+/* fn called when a telemetry characteristic is read, a central can poll the current value
+ * in one round-trip instead of subscribing. The value is rebuilt at the start of each (long) read.
+ */
+static ssize_t on_read_telemetry(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, uint16_t len,
+                                 uint16_t offset)
+{
+    struct ble_link *link = &links[bt_conn_index(conn)];
+
+    if (offset == 0)
+    {
+        link->read_len = ble_encode_read(POINTER_TO_UINT(attr->user_data), link->read_value, sizeof(link->read_value));
+    }
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, link->read_value, link->read_len);
+}
+
+// fn called when the diag characteristic is read, the value is rebuilt at the start of each (long) read
+static ssize_t on_read_diag(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, uint16_t len,
+                            uint16_t offset)
+{
+    static uint8_t value[DIAG_MAXLEN];
+    static size_t value_len;
+
+    if (!IS_ENABLED(CONFIG_DIAG))
+    {
+        return BT_GATT_ERR(BT_ATT_ERR_NOT_SUPPORTED);
+    }
+    if (offset == 0)
+    {
+        value_len = diag_encode(value, sizeof(value));
+    }
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, value, value_len);
+}
+
+// fn called when the counters characteristic is read, returns the counter deltas since the last reset
+static ssize_t on_read_counters(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, uint16_t len,
+                                uint16_t offset)
+{
+    static uint8_t value[6 + COUNTER_COUNT * sizeof(uint32_t)];
+    static size_t value_len;
+
+    if (offset == 0)
+    {
+        value_len = counters_export(value, sizeof(value));
+    }
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, value, value_len);
+}
+
+// fn called when the counters characteristic is written, any single byte write resets the exported counters
+static ssize_t on_receive_counters_wr(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *buf,
+                                      uint16_t len, uint16_t offset, uint8_t flags)
+{
+    if (offset != 0 || len != 1)
+    {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    counters_export_reset();
+    LOG_INF("Event counters reset");
+    return len;
+}
+
+#if defined(CONFIG_ADC_BURST)
+#define BURST_MAXLEN ADC_BURST_MAXLEN
+#else
+#define BURST_MAXLEN 1
+#endif
+#define BLE_ATTR_BURST 22 // value attribute of the burst characteristic in pmic_hub
+
+static void ble_burst_done(void);
+
+// fn called when the burst characteristic is read, returns the summary of the last burst
+static ssize_t on_read_burst(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, uint16_t len,
+                             uint16_t offset)
+{
+    static uint8_t value[BURST_MAXLEN];
+    static size_t value_len;
+
+    if (!IS_ENABLED(CONFIG_ADC_BURST))
+    {
+        return BT_GATT_ERR(BT_ATT_ERR_NOT_SUPPORTED);
+    }
+    if (offset == 0)
+    {
+        value_len = adc_burst_encode(value, sizeof(value));
+    }
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, value, value_len);
+}
+
+// fn called when the burst characteristic is written, [channel mask u8] starts a capture
+static ssize_t on_receive_burst_wr(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *buf,
+                                   uint16_t len, uint16_t offset, uint8_t flags)
+{
+    if (!IS_ENABLED(CONFIG_ADC_BURST))
+    {
+        return BT_GATT_ERR(BT_ATT_ERR_NOT_SUPPORTED);
+    }
+    if (offset != 0 || len != 1)
+    {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    int err = adc_burst_request(((const uint8_t *)buf)[0], ble_burst_done);
+    if (err == -EBUSY)
+    {
+        return BT_GATT_ERR(BT_ATT_ERR_PROCEDURE_IN_PROGRESS);
+    }
+    if (err)
+    {
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+    LOG_INF("Burst capture requested");
+    return len;
+}
+
 /*
 primary
 rd all
@@ -169,40 +643,273 @@ rd boost
 rd lsldo
 wr lsldo
 rd batt
+rw cfg
+rd diag
+rw counters
+rwn burst
 */
 BT_GATT_SERVICE_DEFINE(
     pmic_hub, BT_GATT_PRIMARY_SERVICE(BT_UUID_PMIC_HUB),
-    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_RD_ALL, BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_READ, NULL, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_RD_ALL, BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_READ,
+                           on_read_telemetry, NULL, UINT_TO_POINTER(BLE_CHAR_RD_ALL)),
     BT_GATT_CCC(on_cccd_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
-    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_BOOST_RD_MV, BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_READ, NULL, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_BOOST_RD_MV, BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_READ,
+                           on_read_telemetry, NULL, UINT_TO_POINTER(BLE_CHAR_BOOST)),
     BT_GATT_CCC(on_cccd_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
-    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_LSLDO_RD_MV, BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_READ, NULL, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_LSLDO_RD_MV, BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_READ,
+                           on_read_telemetry, NULL, UINT_TO_POINTER(BLE_CHAR_LSLDO)),
     BT_GATT_CCC(on_cccd_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
     BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_LSLDO_WR_MV, BT_GATT_CHRC_WRITE | BT_GATT_CHRC_WRITE_WITHOUT_RESP,
                            BT_GATT_PERM_READ | BT_GATT_PERM_WRITE, NULL, on_receive_lsldo_wr, NULL),
-    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_BATT_RD, BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_READ, NULL, NULL, NULL),
-    BT_GATT_CCC(on_cccd_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE), );
+    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_BATT_RD, BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_READ,
+                           on_read_telemetry, NULL, UINT_TO_POINTER(BLE_CHAR_BATT)),
+    BT_GATT_CCC(on_cccd_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_CFG_RW, BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_READ | BT_GATT_PERM_WRITE, on_read_cfg, on_receive_cfg_wr, NULL),
+    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_DIAG_RD, BT_GATT_CHRC_READ, BT_GATT_PERM_READ, on_read_diag, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_COUNTERS_RW, BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_READ | BT_GATT_PERM_WRITE, on_read_counters, on_receive_counters_wr, NULL),
+    BT_GATT_CHARACTERISTIC(BT_UUID_PMIC_HUB_BURST_RW, BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE | BT_GATT_CHRC_NOTIFY,
+                           BT_GATT_PERM_READ | BT_GATT_PERM_WRITE, on_read_burst, on_receive_burst_wr, NULL),
+    BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE), );
+
+static int ble_notify_attr(struct ble_link *link, struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                           const void *data, uint16_t len);
+
+/* burst thread context, the summary goes to every subscribed central whose MTU fits it, through
+ * the same per-link window as the telemetry. The others have to read the characteristic.
+ */
+static void ble_burst_done(void)
+{
+    const struct bt_gatt_attr *attr = &pmic_hub.attrs[BLE_ATTR_BURST];
+    uint8_t value[BURST_MAXLEN];
+    size_t len = adc_burst_encode(value, sizeof(value));
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(links); i++)
+    {
+        struct bt_conn *conn = ble_link_conn(i);
+
+        if (!conn)
+        {
+            continue;
+        }
+        if (bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY))
+        {
+            uint16_t payload_mtu = bt_gatt_get_mtu(conn) - 3; // 3 bytes used for Attribute headers.
+            int err = -EMSGSIZE;
+
+            if (len <= payload_mtu)
+            {
+                err = ble_notify_attr(&links[i], conn, attr, value, len);
+            }
+            if (err)
+            {
+                LOG_INF("Burst summary (%d bytes) not notified to central %d (MTU %u, err %d), it has to read it",
+                        (int)len, (int)i, payload_mtu + 3, err);
+            }
+        }
+        bt_conn_unref(conn);
+    }
+}
 
 // BT globals and callbacks
-struct bt_conn *m_connection_handle = NULL;
-static struct bt_gatt_exchange_params exchange_params;
+static bool per_adv_running(void);
+
+/* Connectable while a slot is free. Once every slot is taken the record stays on air in a
+ * non-connectable set: the periodic train when it runs, the legacy set otherwise.
+ */
+static enum ble_adv_mode ble_adv_mode_wanted(void)
+{
+    if (ble_links_count() < CONFIG_BT_MAX_CONN)
+    {
+        return BLE_ADV_CONN;
+    }
+    if (!IS_ENABLED(CONFIG_BLE_ADV_TELEMETRY) || per_adv_running())
+    {
+        return BLE_ADV_OFF;
+    }
+    return BLE_ADV_NCONN;
+}
+
 static void adv_work_handler(struct k_work *work)
 {
-    int err = bt_le_adv_start(adv_param, ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+    enum ble_adv_mode mode = ble_adv_mode_wanted();
+    int err;
+
+    // legacy advertising is a single set, switching modes means stopping it first
+    if (mode != adv_mode && adv_mode != BLE_ADV_OFF)
+    {
+        err = bt_le_adv_stop();
+        if (err)
+        {
+            LOG_WRN("bt_le_adv_stop() returned %d", err);
+        }
+        adv_mode = BLE_ADV_OFF;
+        counters_set_radio_state(COUNTERS_RADIO_SLOT_ADV, COUNTERS_RADIO_IDLE, 0, 0);
+    }
+
+    switch (mode)
+    {
+    case BLE_ADV_CONN:
+        err = bt_le_adv_start(adv_param, ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+        break;
+#if defined(CONFIG_BLE_ADV_TELEMETRY)
+    case BLE_ADV_NCONN:
+        // non-scannable, so no scan response: the record and the name are in the advertising data
+        err = bt_le_adv_start(adv_param_nconn, ad, ARRAY_SIZE(ad), NULL, 0);
+        break;
+#endif
+    default:
+        return;
+    }
+    if (err == -EALREADY)
+    {
+        return; // a recycled connection and a new one both asked for it
+    }
+    if (err)
+    {
+        LOG_INF("Advertising failed to start (err %d)", err);
+        return;
+    }
+
+    adv_mode = mode;
+    LOG_INF("%s advertising successfully started", mode == BLE_ADV_CONN ? "Connectable" : "Non-connectable");
+    counters_set_radio_state(COUNTERS_RADIO_SLOT_ADV, COUNTERS_RADIO_ADVERTISING, BLE_ADV_INTERVAL_MS, 0);
+}
+
+static void advertising_start(void)
+{
+    k_work_submit(&adv_work);
+}
+
+#if defined(CONFIG_BLE_ADV_TELEMETRY)
+
+#define PER_ADV_INTERVAL_UNITS(ms) ((ms) * 4 / 5) // 1.25 ms units
+
+static struct k_work adv_update_work;
+static struct k_spinlock adv_staged_lock;
+static struct ble_record adv_staged; // latest sample from the publisher
+static uint8_t adv_seq;
+
+#if defined(CONFIG_BLE_ADV_PERIODIC)
+static struct bt_le_ext_adv *per_adv;
+static bool per_adv_on; // set once the set and its train run, connections do not stop them
+static uint8_t per_adv_mfg_data[2 + sizeof(struct ble_record)];
+static const struct bt_data per_ad[] = {
+    BT_DATA(BT_DATA_MANUFACTURER_DATA, per_adv_mfg_data, sizeof(per_adv_mfg_data)),
+};
+// extended advertising has room for the full name next to the service UUID
+static const struct bt_data per_ext_ad[] = {
+    BT_DATA(BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN),
+    BT_DATA_BYTES(BT_DATA_UUID128_ALL, PMIC_HUB_SERVICE_UUID),
+};
+
+// non-connectable extended set that only anchors the periodic train, the connectable advertising is unchanged
+static int per_adv_start(void)
+{
+    const struct bt_le_per_adv_param *param =
+        BT_LE_PER_ADV_PARAM(PER_ADV_INTERVAL_UNITS(CONFIG_BLE_ADV_PERIODIC_INTERVAL_MS),
+                            PER_ADV_INTERVAL_UNITS(CONFIG_BLE_ADV_PERIODIC_INTERVAL_MS), BT_LE_PER_ADV_OPT_NONE);
+    int err;
+
+    err = bt_le_ext_adv_create(BT_LE_EXT_ADV_NCONN, NULL, &per_adv);
+    if (err)
+    {
+        LOG_ERR("bt_le_ext_adv_create() returned %d", err);
+        return err;
+    }
+    err = bt_le_ext_adv_set_data(per_adv, per_ext_ad, ARRAY_SIZE(per_ext_ad), NULL, 0);
+    if (!err)
+    {
+        err = bt_le_per_adv_set_param(per_adv, param);
+    }
+    if (!err)
+    {
+        err = bt_le_per_adv_set_data(per_adv, per_ad, ARRAY_SIZE(per_ad));
+    }
+    if (!err)
+    {
+        err = bt_le_per_adv_start(per_adv);
+    }
+    if (!err)
+    {
+        err = bt_le_ext_adv_start(per_adv, BT_LE_EXT_ADV_START_DEFAULT);
+    }
     if (err)
     {
-        LOG_INF("Advertising failed to start (err %d)", err);
-        return;
+        LOG_ERR("Periodic advertising failed to start (err %d)", err);
+        return err;
+    }
+
+    LOG_INF("Periodic advertising started, interval %d ms", CONFIG_BLE_ADV_PERIODIC_INTERVAL_MS);
+    counters_set_radio_state(COUNTERS_RADIO_SLOT_PER_ADV, COUNTERS_RADIO_ADVERTISING,
+                             CONFIG_BLE_ADV_PERIODIC_INTERVAL_MS, 0);
+    per_adv_on = true;
+    return 0;
+}
+#endif // CONFIG_BLE_ADV_PERIODIC
+
+// rewrite the advertised record in place, on the system workqueue so it never races an advertising start
+static void adv_update_work_handler(struct k_work *work)
+{
+    struct ble_record rec;
+    int err;
+
+    k_spinlock_key_t key = k_spin_lock(&adv_staged_lock);
+    rec = adv_staged;
+    k_spin_unlock(&adv_staged_lock, key);
+
+    adv_seq++;
+    ble_adv_record_encode(CONFIG_BLE_ADV_COMPANY_ID, adv_seq, &rec, adv_mfg_data);
+    err = bt_le_adv_update_data(ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+    if (err && err != -EAGAIN) // -EAGAIN: not advertising right now, the next start picks the record up
+    {
+        LOG_WRN("bt_le_adv_update_data() returned %d", err);
     }
 
-    LOG_INF("Advertising successfully started");
+#if defined(CONFIG_BLE_ADV_PERIODIC)
+    if (per_adv)
+    {
+        rec.seq = adv_seq;
+        sys_put_le16(CONFIG_BLE_ADV_COMPANY_ID, per_adv_mfg_data);
+        ble_record_encode(&rec, &per_adv_mfg_data[2]);
+        err = bt_le_per_adv_set_data(per_adv, per_ad, ARRAY_SIZE(per_ad));
+        if (err)
+        {
+            LOG_WRN("bt_le_per_adv_set_data() returned %d", err);
+        }
+    }
+#endif
 }
 
-static void advertising_start(void)
+// hand the latest sample to the advertising data, called once per new snapshot
+static void ble_adv_publish(const struct adc_sample_msg *adc_msg, const struct pmic_report_msg *pmic_msg)
 {
-    k_work_submit(&adv_work);
+    k_spinlock_key_t key = k_spin_lock(&adv_staged_lock);
+
+    ble_fill_record(&adv_staged, adc_msg, pmic_msg);
+    k_spin_unlock(&adv_staged_lock, key);
+
+    k_work_submit(&adv_update_work);
+}
+
+#endif // CONFIG_BLE_ADV_TELEMETRY
+
+static bool per_adv_running(void)
+{
+#if defined(CONFIG_BLE_ADV_PERIODIC)
+    return per_adv_on;
+#else
+    return false;
+#endif
 }
 
+// a freed slot switches the advertising back to connectable
 static void recycled_cb(void)
 {
     LOG_INF("Connection object available from previous conn. Disconnect is "
@@ -229,10 +936,10 @@ static void update_data_length(struct bt_conn *conn)
 {
     int err;
     struct bt_conn_le_data_len_param my_data_len = {
-        .tx_max_len = CONFIG_BT_CTLR_DATA_LENGTH_MAX,
+        .tx_max_len = CONFIG_BT_BUF_ACL_TX_SIZE,
         .tx_max_time = BT_GAP_DATA_TIME_MAX,
     };
-    err = bt_conn_le_data_len_update(m_connection_handle, &my_data_len);
+    err = bt_conn_le_data_len_update(conn, &my_data_len);
     if (err)
     {
         LOG_ERR("data_len_update failed (err %d)", err);
@@ -252,9 +959,10 @@ static void exchange_func(struct bt_conn *conn, uint8_t att_err, struct bt_gatt_
 static void update_mtu(struct bt_conn *conn)
 {
     int err;
-    exchange_params.func = exchange_func;
+    struct bt_gatt_exchange_params *exchange_params = &links[bt_conn_index(conn)].exchange_params;
 
-    err = bt_gatt_exchange_mtu(conn, &exchange_params);
+    exchange_params->func = exchange_func;
+    err = bt_gatt_exchange_mtu(conn, exchange_params);
     if (err)
     {
         LOG_ERR("bt_gatt_exchange_mtu failed (err %d)", err);
@@ -268,35 +976,86 @@ static void connected(struct bt_conn *conn, uint8_t err)
         LOG_WRN("Connection failed (err %u)", err);
         return;
     }
-    m_connection_handle = bt_conn_ref(conn);
-    LOG_INF("Connected");
+
+    uint8_t idx = bt_conn_index(conn);
+    struct ble_link *link = &links[idx];
+
+    // a new central starts with whatever no central has received yet
+    link->cursor = IS_ENABLED(CONFIG_BLE_REPORT_FORMAT_BINARY) ? ble_history_undelivered() : 0;
+    link->last_flush = 0;
+    link->deferred = 0;
+    atomic_set(&link->in_flight, 0);
+    atomic_set(&link->flags, BIT(BLE_LINK_CATCH_UP) | BIT(BLE_LINK_GATE_RESET));
+
+    k_spinlock_key_t key = k_spin_lock(&links_lock);
+    link->conn = bt_conn_ref(conn);
+    k_spin_unlock(&links_lock, key);
+
+    size_t count = ble_links_count();
+    LOG_INF("Connected, central %d (%d of %d)", idx, (int)count, CONFIG_BT_MAX_CONN);
+    ble_links_update_sched();
+
+    // connectable advertising stops on a connection, restart it while there is room for another central,
+    // or keep only the record on air once the last slot is taken
+    counters_set_radio_state(COUNTERS_RADIO_SLOT_ADV, COUNTERS_RADIO_IDLE, 0, 0);
+    advertising_start();
 
     struct bt_conn_info info;
-    err = bt_conn_get_info(m_connection_handle, &info);
+    err = bt_conn_get_info(conn, &info);
     if (err)
     {
         LOG_ERR("bt_conn_get_info() returned %d", err);
         return;
     }
-    double connection_interval = info.le.interval * 1.25; // in ms
-    uint16_t supervision_timeout = info.le.timeout * 10;  // in ms
-    LOG_INF("Connection parameters: interval %.2f ms, latency %d intervals, timeout %d ms", connection_interval,
-            info.le.latency, supervision_timeout);
+    uint32_t connection_interval = info.le.interval * 125; // in 0.01 ms
+    uint16_t supervision_timeout = info.le.timeout * 10;   // in ms
+    LOG_INF("Connection parameters: interval " CENTI_FMT " ms, latency %d intervals, timeout %d ms",
+            CENTI_ARGS(connection_interval), info.le.latency, supervision_timeout);
+    counters_set_radio_state(COUNTERS_RADIO_SLOT_LINK(idx), COUNTERS_RADIO_CONNECTED, info.le.interval * 5 / 4,
+                             info.le.latency);
+    if (IS_ENABLED(CONFIG_BLE_CONN_PARAM))
+    {
+        ble_conn_param_updated(conn, info.le.interval, info.le.latency, info.le.timeout);
+        ble_conn_param_connected(conn, BLE_REPORT_PERIOD_MS());
+    }
 
-    update_phy(m_connection_handle);
+    update_phy(conn);
     k_sleep(K_MSEC(1000)); // Delay added to avoid link layer collisions.
-    update_data_length(m_connection_handle);
-    update_mtu(m_connection_handle);
+    update_data_length(conn);
+    update_mtu(conn);
 
     dk_set_led_on(BLE_STATE_LED);
 }
 
 static void disconnected(struct bt_conn *conn, uint8_t reason)
 {
-    LOG_INF("Disconnected (reason %u)", reason);
-    bt_conn_unref(m_connection_handle);
-    m_connection_handle = NULL;
-    dk_set_led_off(BLE_STATE_LED);
+    uint8_t idx = bt_conn_index(conn);
+    struct ble_link *link = &links[idx];
+
+    k_spinlock_key_t key = k_spin_lock(&links_lock);
+    struct bt_conn *ref = link->conn;
+    link->conn = NULL;
+    k_spin_unlock(&links_lock, key);
+
+    LOG_INF("Disconnected, central %d (reason %u)", idx, reason);
+    if (link->deferred)
+    {
+        LOG_INF("%u notifications to central %d were held back by flow control", link->deferred, idx);
+    }
+    if (ref)
+    {
+        bt_conn_unref(ref);
+    }
+    if (IS_ENABLED(CONFIG_BLE_CONN_PARAM))
+    {
+        ble_conn_param_disconnected(conn);
+    }
+    ble_links_update_sched();
+    counters_set_radio_state(COUNTERS_RADIO_SLOT_LINK(idx), COUNTERS_RADIO_IDLE, 0, 0);
+    if (ble_links_count() == 0)
+    {
+        dk_set_led_off(BLE_STATE_LED);
+    }
 }
 
 struct bt_conn_cb connection_callbacks = {
@@ -308,82 +1067,397 @@ struct bt_conn_cb connection_callbacks = {
     .le_data_len_updated = on_le_data_len_updated,
 };
 
-static void ble_report_pmic_stat(struct bt_conn *conn, const uint8_t *data, uint16_t len)
+static inline void ble_count_notify(uint16_t len)
 {
-    const struct bt_gatt_attr *attr = &pmic_hub.attrs[2];
-    struct bt_gatt_notify_params params = {
-        .uuid = BT_UUID_PMIC_HUB_RD_ALL, .attr = attr, .data = data, .len = len, .func = NULL};
+    counter_inc(COUNTER_BLE_NOTIFY);
+    counter_add(COUNTER_BLE_TX_BYTES, len);
+}
+
+// value attributes of the notified characteristics in pmic_hub
+static const struct
+{
+    uint8_t attr;
+    const char *name;
+} ble_chars[BLE_CHAR_COUNT] = {
+    [BLE_CHAR_RD_ALL] = {2, "pmic stat"},
+    [BLE_CHAR_BOOST] = {5, "boost mv"},
+    [BLE_CHAR_LSLDO] = {8, "lsldo mv"},
+    [BLE_CHAR_BATT] = {13, "batt read"},
+};
 
-    if (bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY))
+// true if the central has notifications enabled on any telemetry characteristic
+static bool ble_any_subscribed(struct bt_conn *conn)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(ble_chars); i++)
     {
-        if (bt_gatt_notify_cb(conn, &params))
+        if (bt_gatt_is_subscribed(conn, &pmic_hub.attrs[ble_chars[i].attr], BT_GATT_CCC_NOTIFY))
         {
-            LOG_ERR("Error, unable to send notification");
+            return true;
         }
     }
+    return false;
+}
+
+// the stack is done with a notification, either sent or dropped with the link
+static void ble_notify_done(struct bt_conn *conn, void *user_data)
+{
+    struct ble_link *link = user_data;
+
+    atomic_dec(&link->in_flight);
+}
+
+/* Notify any attribute to one central within its window. The data is copied into a stack buffer
+ * before this returns, so the same payload can be handed to every central. A central that still
+ * has CONFIG_BLE_LINK_TX_WINDOW notifications waiting gets nothing new until they are sent, so a
+ * slow link cannot hold all the TX buffers and block the publisher for the others.
+ * Returns -EAGAIN if not subscribed and -EBUSY if held back.
+ */
+static int ble_notify_attr(struct ble_link *link, struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                           const void *data, uint16_t len)
+{
+    struct bt_gatt_notify_params params = {
+        .attr = attr, .data = data, .len = len, .func = ble_notify_done, .user_data = link};
+    int err;
+
+    if (!bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY))
+    {
+        return -EAGAIN;
+    }
+    if (atomic_get(&link->in_flight) >= CONFIG_BLE_LINK_TX_WINDOW)
+    {
+        return -EBUSY;
+    }
+
+    atomic_inc(&link->in_flight);
+    err = bt_gatt_notify_cb(conn, &params);
+    if (err)
+    {
+        atomic_dec(&link->in_flight);
+        LOG_ERR("Error, unable to send notification");
+    }
     else
     {
-        LOG_WRN("Warning, notification not enabled for pmic stat characteristic");
+        ble_count_notify(len);
     }
+    return err;
 }
 
-static void ble_report_boost_mv(struct bt_conn *conn, const uint32_t *data, uint16_t len)
+// notify one telemetry characteristic from the publisher, which owns the deferred count
+static int ble_notify(struct ble_link *link, struct bt_conn *conn, enum ble_char chr, const void *data, uint16_t len)
 {
-    const struct bt_gatt_attr *attr = &pmic_hub.attrs[5];
-    struct bt_gatt_notify_params params = {
-        .uuid = BT_UUID_PMIC_HUB_BOOST_RD_MV, .attr = attr, .data = data, .len = len, .func = NULL};
+    int err = ble_notify_attr(link, conn, &pmic_hub.attrs[ble_chars[chr].attr], data, len);
+
+    if (err == -EAGAIN)
+    {
+        LOG_WRN("Warning, notification not enabled for %s characteristic", ble_chars[chr].name);
+    }
+    else if (err == -EBUSY)
+    {
+        link->deferred++;
+    }
+    return err;
+}
 
-    if (bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY))
+// one characteristic value of a tick, with the gate to advance once it is accepted
+struct ble_notify_item
+{
+    enum ble_char chr;
+    enum ble_gate_id gate;
+    const void *data;
+    uint16_t len;
+};
+
+/* Send a tick's values to one central. With CONFIG_BLE_NOTIFY_MULTIPLE the set is handed to the
+ * stack back to back, which packs it into one ATT Multiple Handle Value Notification when the
+ * central enabled that feature (and sends them one by one otherwise). The set is only admitted
+ * whole into the link's window, every value is one slot since the stack completes each one
+ * separately. Values the stack refuses go through the plain path, the accepted ones are not resent.
+ * Returns a mask of the accepted items.
+ */
+static uint32_t ble_notify_items(struct ble_link *link, struct bt_conn *conn, const struct ble_notify_item *items,
+                                 size_t count)
+{
+    uint32_t sent = 0;
+
+#if defined(CONFIG_BLE_NOTIFY_MULTIPLE)
+    struct bt_gatt_notify_params params[BLE_CHAR_COUNT];
+    uint8_t index[BLE_CHAR_COUNT];
+    size_t n = 0;
+
+    for (size_t i = 0; i < count; i++)
     {
-        if (bt_gatt_notify_cb(conn, &params))
+        const struct bt_gatt_attr *attr = &pmic_hub.attrs[ble_chars[items[i].chr].attr];
+
+        if (bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY))
         {
-            LOG_ERR("Error, unable to send notification");
+            params[n] = (struct bt_gatt_notify_params){
+                .attr = attr,
+                .data = items[i].data,
+                .len = items[i].len,
+                .func = ble_notify_done,
+                .user_data = link,
+            };
+            index[n++] = i;
         }
     }
-    else
+
+    // a single value uses the plain path
+    if (n >= 2)
+    {
+        if (atomic_get(&link->in_flight) + (atomic_val_t)n > CONFIG_BLE_LINK_TX_WINDOW)
+        {
+            link->deferred += n;
+            return 0;
+        }
+
+        uint16_t total = 0;
+        size_t accepted = 0;
+
+        /* what bt_gatt_notify_multiple() does, but it does not tell how many values it queued before
+         * a failure, this loop does
+         */
+        atomic_add(&link->in_flight, (atomic_val_t)n);
+        for (; accepted < n; accepted++)
+        {
+            int err = bt_gatt_notify_cb(conn, &params[accepted]);
+
+            if (err)
+            {
+                LOG_DBG("Notification %d of %d refused (%d), sending the rest one by one", (int)accepted + 1,
+                        (int)n, err);
+                break;
+            }
+            sent |= BIT(index[accepted]);
+            total += 4 + params[accepted].len; // handle and length per value
+        }
+        atomic_sub(&link->in_flight, (atomic_val_t)(n - accepted));
+        if (accepted)
+        {
+            ble_count_notify(total);
+        }
+        if (accepted == n)
+        {
+            return sent;
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < count; i++)
     {
-        LOG_WRN("Warning, notification not enabled for boost mv characteristic");
+        if (!(sent & BIT(i)) && !ble_notify(link, conn, items[i].chr, items[i].data, items[i].len))
+        {
+            sent |= BIT(i);
+        }
     }
+    return sent;
+}
+
+// fill a fixed-point RD ALL record from module messages, without a sequence number
+static void ble_fill_record(struct ble_record *rec, const struct adc_sample_msg *adc_msg,
+                            const struct pmic_report_msg *pmic_msg)
+{
+    *rec = (struct ble_record){
+        .version = BLE_RECORD_VERSION,
+        .timestamp = pmic_msg->timestamp,
+        .soc = pmic_msg->soc,
+        .vbat = pmic_msg->vbat_mv,
+        .temp = pmic_msg->temp,
+        .boost = (int16_t)adc_msg->channel_mv[0],
+        .lsldo = (int16_t)adc_msg->channel_mv[1],
+    };
 }
 
-static void ble_report_lsldo_mv(struct bt_conn *conn, const uint32_t *data, uint16_t len)
+// fill the next RD ALL record for the history ring from the latest module messages
+static void ble_build_record(struct ble_record *rec, const struct adc_sample_msg *adc_msg,
+                             const struct pmic_report_msg *pmic_msg)
 {
-    const struct bt_gatt_attr *attr = &pmic_hub.attrs[8];
+    static uint16_t report_seq;
 
+    ble_fill_record(rec, adc_msg, pmic_msg);
+    rec->seq = report_seq++;
+}
+
+// compatibility plaintext summary, only used with CONFIG_BLE_REPORT_FORMAT_TEXT
+static int ble_encode_text(uint8_t *buf, size_t size, const struct adc_sample_msg *adc_msg,
+                           const struct pmic_report_msg *pmic_msg)
+{
+    // BATTV keeps the original two decimals
+    return snprintf(buf, size,
+                    "BATT: " CENTI_FMT "%% , BATTV: " CENTI_FMT "V , TEMP: " CENTI_FMT "C  | LDO: %dmV , BOOST: %dmV",
+                    CENTI_ARGS(pmic_msg->soc), CENTI_ARGS(pmic_msg->vbat_mv / 10), CENTI_ARGS(pmic_msg->temp),
+                    adc_msg->channel_mv[1], adc_msg->channel_mv[0]);
+}
+
+#if defined(CONFIG_BENCH)
+
+struct ble_bench_notify
+{
+    struct bt_conn *conn;
+    struct k_sem done;
+    uint8_t value[sizeof(uint32_t)];
+};
+
+// static, a notification that outlives the case still completes into it
+static struct ble_bench_notify bench_notify_ctx;
+
+static int bench_summary_text(void *ctx)
+{
+    const struct telemetry_snapshot *snap = ctx;
+    uint8_t buf[MAXLEN];
+
+    return ble_encode_text(buf, sizeof(buf), &snap->adc, &snap->pmic);
+}
+
+static void bench_notify_done(struct bt_conn *conn, void *user_data)
+{
+    struct ble_bench_notify *b = user_data;
+
+    k_sem_give(&b->done);
+}
+
+// one notification in flight at a time, waiting for the previous one is not part of the cost
+static int bench_notify_prepare(void *ctx)
+{
+    struct ble_bench_notify *b = ctx;
+
+    return k_sem_take(&b->done, K_SECONDS(5)) ? -ETIMEDOUT : 0;
+}
+
+// the cost of handing a notification to the host stack, not of sending it
+static int bench_notify(void *ctx)
+{
+    struct ble_bench_notify *b = ctx;
     struct bt_gatt_notify_params params = {
-        .uuid = BT_UUID_PMIC_HUB_LSLDO_RD_MV, .attr = attr, .data = data, .len = len, .func = NULL};
+        .attr = &pmic_hub.attrs[ble_chars[BLE_CHAR_BATT].attr],
+        .data = b->value,
+        .len = sizeof(b->value),
+        .func = bench_notify_done,
+        .user_data = b,
+    };
+    int err = bt_gatt_notify_cb(b->conn, &params);
+
+    if (err == 0)
+    {
+        ble_count_notify(sizeof(b->value));
+    }
+    return err;
+}
+
+int ble_bench(uint32_t iterations)
+{
+    struct ble_bench_notify *b = &bench_notify_ctx;
+    struct telemetry_snapshot snap;
+    int err;
+
+    telemetry_read(&snap);
+    err = bench_measure("summary_text", NULL, bench_summary_text, &snap, iterations);
+    if (err)
+    {
+        return err;
+    }
 
-    if (bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY))
+    b->conn = NULL;
+    for (size_t i = 0; i < ARRAY_SIZE(links) && !b->conn; i++)
     {
-        // Send the notification
-        if (bt_gatt_notify_cb(conn, &params))
+        struct bt_conn *conn = ble_link_conn(i);
+
+        if (conn && bt_gatt_is_subscribed(conn, &pmic_hub.attrs[ble_chars[BLE_CHAR_BATT].attr], BT_GATT_CCC_NOTIFY))
         {
-            LOG_ERR("Error, unable to send notification");
+            b->conn = conn;
+        }
+        else if (conn)
+        {
+            bt_conn_unref(conn);
         }
     }
-    else
+    if (!b->conn)
     {
-        LOG_WRN("Warning, notification not enabled for lsldo mv characteristic");
+        LOG_WRN("No central subscribed to Battery Read, notify case skipped");
+        return -EAGAIN;
     }
+
+    k_sem_init(&b->done, 1, 1);
+    sys_put_le32(snap.pmic.soc / 100, b->value);
+    err = bench_measure("notify", bench_notify_prepare, bench_notify, b, iterations);
+    (void)k_sem_take(&b->done, K_SECONDS(5));
+    bt_conn_unref(b->conn);
+    return err;
 }
 
-static void ble_report_batt_soc(struct bt_conn *conn, const uint32_t *data, uint16_t len)
+#endif // CONFIG_BENCH
+
+/* Encode the next RD ALL frame from the central's cursor, at most max_recs records.
+ * The last frame is kept, a central at the same position with the same MTU gets it as is.
+ * Returns the number of records in the frame, 0 if the central has every record.
+ */
+static size_t ble_history_frame(struct ble_link *link, size_t max_recs, const uint8_t **frame_out, size_t *len_out)
 {
-    const struct bt_gatt_attr *attr = &pmic_hub.attrs[13];
-    struct bt_gatt_notify_params params = {
-        .uuid = BT_UUID_PMIC_HUB_BATT_RD, .attr = attr, .data = data, .len = len, .func = NULL};
+    static uint8_t frame[MAXLEN];
+    static size_t frame_len;
+    static uint32_t frame_cursor;
+    static size_t frame_recs;
+    struct ble_record recs[(MAXLEN - BLE_RECORD_BATCH_HDR_LEN) / sizeof(struct ble_record)];
+    size_t n = ble_history_read(&link->cursor, recs, CLAMP(max_recs, 1, ARRAY_SIZE(recs)));
 
-    if (bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY))
+    if (n == 0)
+    {
+        return 0;
+    }
+    if (frame_recs != n || frame_cursor != link->cursor)
     {
-        if (bt_gatt_notify_cb(conn, &params))
+        size_t len = 0;
+
+        if (n == 1 && !IS_ENABLED(CONFIG_BLE_BATCH))
+        {
+            // steady state, keep sending plain single records
+            len = ble_record_encode(&recs[0], frame);
+        }
+        else
         {
-            LOG_ERR("Error, unable to send notification");
+            frame[len++] = BLE_RECORD_BATCH | BLE_RECORD_VERSION;
+            frame[len++] = n;
+            for (size_t i = 0; i < n; i++)
+            {
+                len += ble_record_encode(&recs[i], &frame[len]);
+            }
         }
+        frame_len = len;
+        frame_cursor = link->cursor;
+        frame_recs = n;
     }
-    else
+
+    *frame_out = frame;
+    *len_out = frame_len;
+    return n;
+}
+
+/* Send the history from the central's cursor on the RD ALL characteristic, packing as many
+ * records as its MTU allows. The cursor only moves once a notification was accepted.
+ * Returns true when the central has every record.
+ */
+static bool ble_flush_history(struct ble_link *link, struct bt_conn *conn)
+{
+    size_t payload = MIN(bt_gatt_get_mtu(conn) - 3, MAXLEN); // 3 bytes used for Attribute headers.
+    size_t max_recs = (payload - BLE_RECORD_BATCH_HDR_LEN) / sizeof(struct ble_record);
+    const uint8_t *frame;
+    size_t len;
+    size_t n;
+
+    if (!bt_gatt_is_subscribed(conn, &pmic_hub.attrs[ble_chars[BLE_CHAR_RD_ALL].attr], BT_GATT_CCC_NOTIFY))
+    {
+        return false;
+    }
+
+    while ((n = ble_history_frame(link, max_recs, &frame, &len)) > 0)
     {
-        LOG_WRN("Warning, notification not enabled for batt read characteristic");
+        if (ble_notify(link, conn, BLE_CHAR_RD_ALL, frame, len))
+        {
+            return false;
+        }
+        ble_history_advance(&link->cursor, n);
     }
+
+    return true;
 }
 
 int bt_init(void)
@@ -404,63 +1478,262 @@ int bt_init(void)
     }
     bt_conn_cb_register(&connection_callbacks);
     k_work_init(&adv_work, adv_work_handler);
+#if defined(CONFIG_BLE_ADV_TELEMETRY)
+    k_work_init(&adv_update_work, adv_update_work_handler);
+    ble_adv_record_encode(CONFIG_BLE_ADV_COMPANY_ID, 0, &(struct ble_record){0}, adv_mfg_data);
+#if defined(CONFIG_BLE_ADV_PERIODIC)
+    per_adv_start();
+#endif
+#endif
     advertising_start();
 
     return 0;
 }
 
-void ble_write_thread(void)
+// everything one tick sends, encoded once and handed to every central
+struct ble_tick
 {
-    LOG_INF("ble write thread: enter");
-    k_sem_take(&sem_gpio_ready, K_FOREVER);
-    LOG_INF("ble write thread: woken by main");
+    int64_t now;
+    int32_t values[BLE_SIGNAL_COUNT];
+    const struct adc_sample_msg *adc_msg;
+    const struct pmic_report_msg *pmic_msg;
+    uint32_t battcharge;
+    int text_len; // < 0 until the first central needs it
+};
 
-    if (bt_init() != 0)
+// notify one central whatever it has not seen yet from this tick
+static void ble_publish_link(struct ble_link *link, struct bt_conn *conn, struct ble_tick *tick)
+{
+    static uint8_t ble_pmic_stat[MAXLEN]; // string to hold plaintext pmic report
+    struct ble_notify_item items[BLE_CHAR_COUNT];
+    size_t count = 0;
+    size_t history_recs = 0;
+    bool live_skip = false;
+
+    if (atomic_test_and_clear_bit(&link->flags, BLE_LINK_GATE_RESET))
     {
-        LOG_ERR("unable to initialize BLE!");
+        ble_gate_reset(&link->gates);
     }
-    k_sem_give(&sem_ble_ready);
-    struct adc_sample_msg adc_msg;
-    struct pmic_report_msg pmic_msg;
-    for (;;)
+
+    if (!IS_ENABLED(CONFIG_BLE_BATCH))
+    {
+        if (ble_gate_due(&link->gates, BLE_GATE_BOOST, tick->values, tick->now))
+        {
+            items[count++] = (struct ble_notify_item){BLE_CHAR_BOOST, BLE_GATE_BOOST, &tick->adc_msg->channel_mv[0],
+                                                      sizeof(int32_t)};
+        }
+        if (ble_gate_due(&link->gates, BLE_GATE_LSLDO, tick->values, tick->now))
+        {
+            items[count++] = (struct ble_notify_item){BLE_CHAR_LSLDO, BLE_GATE_LSLDO, &tick->adc_msg->channel_mv[1],
+                                                      sizeof(int32_t)};
+        }
+        if (ble_gate_due(&link->gates, BLE_GATE_BATT, tick->values, tick->now))
+        {
+            items[count++] =
+                (struct ble_notify_item){BLE_CHAR_BATT, BLE_GATE_BATT, &tick->battcharge, sizeof(tick->battcharge)};
+        }
+    }
+
+    if (IS_ENABLED(CONFIG_BLE_REPORT_FORMAT_TEXT))
     {
-        // Wait indefinitely for msg's from other modules
-        k_msgq_get(&adc_msgq, &adc_msg, K_FOREVER);
-        // msg.channel_mv[0] and msg.channel_mv[1] contain latest ADC results
-        LOG_INF("BLE thread rx from ADC: Ch0(BOOST)=%d mV Ch1(LDOLS)=%d mV", adc_msg.channel_mv[0],
-                adc_msg.channel_mv[1]);
-
-        k_msgq_get(&pmic_msgq, &pmic_msg, K_FOREVER);
-        LOG_INF("BLE thread rx from PMIC: V: %.2f T: %.2f SoC: %.2f ", pmic_msg.batt_voltage, pmic_msg.temp,
-                pmic_msg.batt_soc);
-
-        if (m_connection_handle) // if ble connection present
-        {
-            ble_report_boost_mv(m_connection_handle, &adc_msg.channel_mv[0], sizeof(adc_msg.channel_mv[0]));
-            ble_report_lsldo_mv(m_connection_handle, &adc_msg.channel_mv[1], sizeof(adc_msg.channel_mv[1]));
-            uint32_t battcharge = pmic_msg.batt_soc;
-            ble_report_batt_soc(m_connection_handle, &battcharge, sizeof(battcharge));
-            static uint8_t ble_pmic_stat[MAXLEN]; // string to hold plaintext pmic report
-            int len = snprintf(ble_pmic_stat, MAXLEN,
-                               "BATT: %.2f%% , BATTV: %.2fV , TEMP: %.2fC  | LDO: %dmV , BOOST: %dmV", pmic_msg.batt_soc,
-                               pmic_msg.batt_voltage, pmic_msg.temp, adc_msg.channel_mv[1], adc_msg.channel_mv[0]);
-            if (!(len >= 0 && len < MAXLEN))
+        if (ble_gate_due(&link->gates, BLE_GATE_RD_ALL, tick->values, tick->now))
+        {
+            if (tick->text_len < 0)
             {
-                LOG_ERR("ble pmic report too large. (%d)", len);
+                int len = ble_encode_text(ble_pmic_stat, MAXLEN, tick->adc_msg, tick->pmic_msg);
+                if (!(len >= 0 && len < MAXLEN))
+                {
+                    LOG_ERR("ble pmic report too large. (%d)", len);
+                    len = 0;
+                }
+                tick->text_len = len;
             }
-            else
+            if (tick->text_len > 0)
             {
-                ble_report_pmic_stat(m_connection_handle, ble_pmic_stat, len);
+                items[count++] =
+                    (struct ble_notify_item){BLE_CHAR_RD_ALL, BLE_GATE_RD_ALL, ble_pmic_stat, tick->text_len};
             }
         }
+    }
+    else if (!IS_ENABLED(CONFIG_BLE_BATCH) && !atomic_test_bit(&link->flags, BLE_LINK_CATCH_UP) &&
+             ble_history_pending(link->cursor) == 1 &&
+             bt_gatt_is_subscribed(conn, &pmic_hub.attrs[ble_chars[BLE_CHAR_RD_ALL].attr], BT_GATT_CCC_NOTIFY))
+    {
+        // steady state, the new record rides along with the other values if it moved past the deadband
+        if (ble_gate_due(&link->gates, BLE_GATE_RD_ALL, tick->values, tick->now))
+        {
+            const uint8_t *frame;
+            size_t len;
+
+            history_recs = ble_history_frame(link, 1, &frame, &len);
+            items[count++] = (struct ble_notify_item){BLE_CHAR_RD_ALL, BLE_GATE_RD_ALL, frame, len};
+        }
         else
         {
-            LOG_INF("BLE Thread does not detect an active BLE connection");
+            // this central follows live and has a close enough value, the ring keeps the sample for catch-ups
+            ble_history_skip(&link->cursor, 1);
+            live_skip = true;
+        }
+    }
+
+    uint32_t sent = ble_notify_items(link, conn, items, count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!(sent & BIT(i)))
+        {
+            continue;
+        }
+        if (items[i].chr == BLE_CHAR_RD_ALL && history_recs)
+        {
+            ble_history_advance(&link->cursor, history_recs);
+            link->last_flush = tick->now;
+        }
+        ble_gate_sent(&link->gates, items[i].gate, tick->values, tick->now);
+    }
+
+    if (!IS_ENABLED(CONFIG_BLE_REPORT_FORMAT_TEXT) && history_recs == 0 && !live_skip &&
+        (!IS_ENABLED(CONFIG_BLE_BATCH) || atomic_test_bit(&link->flags, BLE_LINK_CATCH_UP) ||
+         (tick->now - link->last_flush) >= BLE_BATCH_FLUSH_INTERVAL_MS))
+    {
+        size_t backlog = ble_history_pending(link->cursor);
+
+        if (ble_flush_history(link, conn))
+        {
+            if (atomic_test_and_clear_bit(&link->flags, BLE_LINK_CATCH_UP) && backlog > 1)
+            {
+                LOG_INF("Catch-up transfer sent %d queued samples to central %d", (int)backlog,
+                        (int)(link - links));
+            }
+            link->last_flush = tick->now;
+            // the central holds the newest record now, live RD ALL notifications measure from it
+            ble_gate_sent(&link->gates, BLE_GATE_RD_ALL, tick->values, tick->now);
+        }
+    }
+}
+
+/* One publisher tick: read the telemetry snapshot, queue every sample in the history ring and
+ * notify every central whatever moved past its deadband. Runs in the BLE thread or as the pipeline
+ * notify stage.
+ */
+int ble_publish(void)
+{
+    static struct telemetry_snapshot snap;
+    static uint32_t last_adc_gen;
+    static uint32_t last_pmic_gen;
+    static uint32_t last_events_gen;
+    static struct ble_record rec;
+    bool any_link = false;
+
+    if (IS_ENABLED(CONFIG_BLE_CONN_PARAM))
+    {
+        ble_conn_param_set_period(BLE_REPORT_PERIOD_MS());
+    }
+
+    // latest values from the other modules, a slow producer only makes its section stale
+    telemetry_read(&snap);
+    if (snap.adc_gen == 0 || snap.pmic_gen == 0)
+    {
+        return 0; // nothing to report until both producers published once
+    }
+    if (snap.adc_gen == last_adc_gen && snap.pmic_gen == last_pmic_gen)
+    {
+        LOG_DBG("BLE thread: no new samples since last tick");
+        return 0;
+    }
+    if (snap.adc_gen - last_adc_gen > 1 || snap.pmic_gen - last_pmic_gen > 1)
+    {
+        LOG_DBG("BLE thread: producers ran ahead, only the latest sample is reported");
+    }
+    last_adc_gen = snap.adc_gen;
+    last_pmic_gen = snap.pmic_gen;
+
+    // an nPM2100 event overrides the deadbands once, with the first fuel gauge sample taken after it
+    if (snap.pmic_events_gen != last_events_gen && (int32_t)(snap.pmic.timestamp - snap.pmic_events_timestamp) >= 0)
+    {
+        last_events_gen = snap.pmic_events_gen;
+        LOG_INF("BLE thread: nPM2100 event 0x%02x, notifying every characteristic", snap.pmic_events);
+        for (size_t i = 0; i < ARRAY_SIZE(links); i++)
+        {
+            atomic_set_bit(&links[i].flags, BLE_LINK_GATE_RESET);
+        }
+    }
+
+    struct adc_sample_msg adc_msg = snap.adc;
+    struct pmic_report_msg pmic_msg = snap.pmic;
+    LOG_INF("BLE thread snapshot ADC: Ch0(BOOST)=%d mV Ch1(LDOLS)=%d mV", adc_msg.channel_mv[0],
+            adc_msg.channel_mv[1]);
+    LOG_INF("BLE thread snapshot PMIC: V: " MILLI_FMT " T: " CENTI_FMT " SoC: " CENTI_FMT " ",
+            MILLI_ARGS(pmic_msg.vbat_mv), CENTI_ARGS(pmic_msg.temp), CENTI_ARGS(pmic_msg.soc));
+
+#if defined(CONFIG_BLE_ADV_TELEMETRY)
+    // scanners get every new sample, deadbands only apply to notifications
+    ble_adv_publish(&adc_msg, &pmic_msg);
+#endif
+
+    // only values that moved past their deadband (or whose heartbeat expired) are sent
+    struct ble_tick tick = {
+        .now = k_uptime_get(),
+        .values =
+            {
+                [BLE_SIGNAL_BOOST_MV] = adc_msg.channel_mv[0],
+                [BLE_SIGNAL_LSLDO_MV] = adc_msg.channel_mv[1],
+                [BLE_SIGNAL_SOC] = pmic_msg.soc,
+                [BLE_SIGNAL_VBAT_MV] = pmic_msg.vbat_mv,
+                [BLE_SIGNAL_TEMP] = pmic_msg.temp,
+            },
+        .adc_msg = &adc_msg,
+        .pmic_msg = &pmic_msg,
+        .battcharge = pmic_msg.soc / 100,
+        .text_len = -1,
+    };
+
+    if (IS_ENABLED(CONFIG_BLE_REPORT_FORMAT_BINARY))
+    {
+        // every sample goes through the history ring, the deadbands only thin out live notifications
+        ble_build_record(&rec, &adc_msg, &pmic_msg);
+        ble_history_push(&rec);
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(links); i++)
+    {
+        struct bt_conn *conn = ble_link_conn(i);
+
+        if (conn)
+        {
+            any_link = true;
+            ble_publish_link(&links[i], conn, &tick);
+            bt_conn_unref(conn);
         }
+    }
+    if (!any_link)
+    {
+        LOG_INF("BLE Thread does not detect an active BLE connection");
+    }
+    return 0;
+}
+
+#if !defined(CONFIG_PIPELINE)
+
+void ble_write_thread(void)
+{
+    LOG_INF("ble write thread: enter");
+    k_sem_take(&sem_gpio_ready, K_FOREVER);
+    LOG_INF("ble write thread: woken by main");
 
-        k_sleep(BLE_NOTIFY_INTERVAL);
+    if (bt_init() != 0)
+    {
+        LOG_ERR("unable to initialize BLE!");
+    }
+    k_sem_give(&sem_ble_ready);
+    for (;;)
+    {
+        sched_sleep(SCHED_STAGE_NOTIFY);
+        ble_publish();
     }
 }
 
 K_THREAD_DEFINE(ble_write_thread_id, BLE_THREAD_STACK_SIZE, ble_write_thread, NULL, NULL, NULL, BLE_THREAD_PRIORITY, 0,
                 0);
+
+#endif // CONFIG_PIPELINE
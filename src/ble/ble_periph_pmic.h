@@ -10,10 +10,40 @@
 #define LSLDO_RD_MV_CHARACTERISTIC_UUID BT_UUID_128_ENCODE(0x757D012D, 0x2EAD, 0x4faf, 0x956b, 0xafb01c17d0be)
 #define LSLDO_WR_MV_CHARACTERISTIC_UUID BT_UUID_128_ENCODE(0x757D0111, 0x217E, 0x4faf, 0x956b, 0xafb01c17d0be)
 #define BATT_RD_CHARACTERISTIC_UUID BT_UUID_128_ENCODE(0xBA77E129, 0x2EAD, 0x5eea, 0x8e62, 0x6aadbe1e624f)
+#define CFG_RW_CHARACTERISTIC_UUID BT_UUID_128_ENCODE(0xC0F16000, 0x217E, 0x4b3a, 0x9d21, 0xc13064b9dea2)
+#define DIAG_RD_CHARACTERISTIC_UUID BT_UUID_128_ENCODE(0xD1A60000, 0x2EAD, 0x4b3a, 0x9d21, 0xc13064b9dea2)
+#define COUNTERS_RW_CHARACTERISTIC_UUID BT_UUID_128_ENCODE(0xC0C07E25, 0x2EAD, 0x4b3a, 0x9d21, 0xc13064b9dea2)
+#define BURST_RW_CHARACTERISTIC_UUID BT_UUID_128_ENCODE(0xB0257000, 0x2EAD, 0x4b3a, 0x9d21, 0xc13064b9dea2)
 
-extern struct k_msgq adc_msgq;
-extern struct k_msgq pmic_msgq;
+/* CFG characteristic: write one entry as [key (1 byte)][value (uint32 little endian)].
+ * A read returns every entry back to back in the same layout.
+ */
+enum ble_cfg_key
+{
+    BLE_CFG_FG_PERIOD_MIN_MS = 0x01,
+    BLE_CFG_FG_PERIOD_MAX_MS = 0x02,
+    BLE_CFG_ADC_PERIOD_MIN_MS = 0x03,
+    BLE_CFG_ADC_PERIOD_MAX_MS = 0x04,
+    BLE_CFG_NOTIFY_PERIOD_MIN_MS = 0x05,
+    BLE_CFG_NOTIFY_PERIOD_MAX_MS = 0x06,
+    // notification deadbands, 0 notifies every new sample
+    BLE_CFG_BOOST_DEADBAND_MV = 0x10,
+    BLE_CFG_LSLDO_DEADBAND_MV = 0x11,
+    BLE_CFG_SOC_DEADBAND = 0x12,  // 0.01 %
+    BLE_CFG_VBAT_DEADBAND_MV = 0x13,
+    BLE_CFG_TEMP_DEADBAND = 0x14, // 0.01 deg C
+    // longest silence per characteristic, 0 disables the heartbeat
+    BLE_CFG_RD_ALL_HEARTBEAT_S = 0x20,
+    BLE_CFG_BOOST_HEARTBEAT_S = 0x21,
+    BLE_CFG_LSLDO_HEARTBEAT_S = 0x22,
+    BLE_CFG_BATT_HEARTBEAT_S = 0x23,
+};
+
+#define BLE_CFG_ENTRY_LEN 5
 
 int bt_init(void);
 
+// one publisher tick, called by the BLE thread or the pipeline
+int ble_publish(void);
+
 #endif
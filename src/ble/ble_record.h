@@ -0,0 +1,158 @@
+#ifndef BLE_RECORD_H_
+#define BLE_RECORD_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/toolchain.h>
+
+#define BLE_RECORD_VERSION 1
+
+/*
+ * Binary layout of the RD ALL summary notification, shared with central-side decoders.
+ * RD ALL record, version 1. All fields little endian, no padding (18 bytes).
+ *
+ * offset|size|field    |unit
+ * ------|----|---------|-------------------------------------------
+ * 0     |1   |version  |BLE_RECORD_VERSION, bump on any layout change
+ * 1     |1   |flags    |BLE_RECORD_FLAG_*, other bits reserved (0)
+ * 2     |2   |seq      |increments per record, wraps at 0xFFFF
+ * 4     |4   |timestamp|ms since boot when the fuel gauge sampled
+ * 8     |2   |soc      |state of charge, 0.01 %
+ * 10    |2   |vbat     |battery voltage, mV
+ * 12    |2   |temp     |die temperature, 0.01 deg C, signed
+ * 14    |2   |boost    |BOOST output, mV, signed (-1 on ADC error)
+ * 16    |2   |lsldo    |LDO/LS output, mV, signed (-1 on ADC error)
+ */
+// the record answers a read of RD ALL and is followed by a u32 age in ms, seq is not used
+#define BLE_RECORD_FLAG_READ 0x01
+
+struct ble_record
+{
+    uint8_t version;
+    uint8_t flags;
+    uint16_t seq;
+    uint32_t timestamp;
+    uint16_t soc;
+    uint16_t vbat;
+    int16_t temp;
+    int16_t boost;
+    int16_t lsldo;
+} __packed;
+
+BUILD_ASSERT(sizeof(struct ble_record) == 18, "RD ALL record layout changed, bump BLE_RECORD_VERSION");
+
+/*
+ * Batch frame, used when several records are sent in one notification.
+ * byte 0 is BLE_RECORD_BATCH | BLE_RECORD_VERSION, byte 1 is the record count,
+ * followed by that many records in the layout above, oldest first.
+ */
+#define BLE_RECORD_BATCH 0x80
+#define BLE_RECORD_BATCH_HDR_LEN 2
+
+// convert a record in host order to its on-air form, buf must hold sizeof(struct ble_record)
+static inline size_t ble_record_encode(const struct ble_record *rec, uint8_t *buf)
+{
+    struct ble_record wire = {
+        .version = BLE_RECORD_VERSION,
+        .flags = rec->flags,
+        .seq = sys_cpu_to_le16(rec->seq),
+        .timestamp = sys_cpu_to_le32(rec->timestamp),
+        .soc = sys_cpu_to_le16(rec->soc),
+        .vbat = sys_cpu_to_le16(rec->vbat),
+        .temp = (int16_t)sys_cpu_to_le16((uint16_t)rec->temp),
+        .boost = (int16_t)sys_cpu_to_le16((uint16_t)rec->boost),
+        .lsldo = (int16_t)sys_cpu_to_le16((uint16_t)rec->lsldo),
+    };
+
+    memcpy(buf, &wire, sizeof(wire));
+    return sizeof(wire);
+}
+
+// decode an on-air record, returns -EINVAL on short buffers and -ENOTSUP on unknown versions
+static inline int ble_record_decode(const uint8_t *buf, size_t len, struct ble_record *rec)
+{
+    if (len < sizeof(*rec))
+    {
+        return -EINVAL;
+    }
+    if (buf[0] != BLE_RECORD_VERSION)
+    {
+        return -ENOTSUP;
+    }
+
+    rec->version = buf[0];
+    rec->flags = buf[1];
+    rec->seq = sys_get_le16(&buf[2]);
+    rec->timestamp = sys_get_le32(&buf[4]);
+    rec->soc = sys_get_le16(&buf[8]);
+    rec->vbat = sys_get_le16(&buf[10]);
+    rec->temp = (int16_t)sys_get_le16(&buf[12]);
+    rec->boost = (int16_t)sys_get_le16(&buf[14]);
+    rec->lsldo = (int16_t)sys_get_le16(&buf[16]);
+
+    return 0;
+}
+
+// number of records in a batch frame, or a negative errno if buf is not a valid batch
+static inline int ble_record_batch_count(const uint8_t *buf, size_t len)
+{
+    if (len < BLE_RECORD_BATCH_HDR_LEN || buf[0] != (BLE_RECORD_BATCH | BLE_RECORD_VERSION))
+    {
+        return -EINVAL;
+    }
+    if (len < BLE_RECORD_BATCH_HDR_LEN + (size_t)buf[1] * sizeof(struct ble_record))
+    {
+        return -EINVAL;
+    }
+    return buf[1];
+}
+
+// decode record idx of a batch frame previously checked with ble_record_batch_count()
+static inline int ble_record_batch_decode(const uint8_t *buf, size_t len, size_t idx, struct ble_record *rec)
+{
+    size_t offset = BLE_RECORD_BATCH_HDR_LEN + idx * sizeof(struct ble_record);
+
+    if (offset >= len)
+    {
+        return -EINVAL;
+    }
+    return ble_record_decode(&buf[offset], len - offset, rec);
+}
+
+/*
+ * Manufacturer specific data in the advertising packet, for passive scanners (12 bytes).
+ * All fields little endian, no padding.
+ *
+ * offset|size|field   |unit
+ * ------|----|--------|-------------------------------------------
+ * 0     |2   |company |CONFIG_BLE_ADV_COMPANY_ID
+ * 2     |1   |version |BLE_ADV_RECORD_VERSION, bump on any layout change
+ * 3     |1   |seq     |increments per update, a scanner drops repeats
+ * 4     |2   |soc     |state of charge, 0.01 %
+ * 6     |2   |vbat    |battery voltage, mV
+ * 8     |2   |boost   |BOOST output, mV, signed (-1 on ADC error)
+ * 10    |2   |lsldo   |LDO/LS output, mV, signed (-1 on ADC error)
+ *
+ * The periodic advertising train (CONFIG_BLE_ADV_PERIODIC) carries the company ID followed by
+ * a whole RD ALL record in the layout above, its seq counting advertising updates.
+ */
+#define BLE_ADV_RECORD_VERSION 1
+#define BLE_ADV_RECORD_LEN 12
+
+static inline size_t ble_adv_record_encode(uint16_t company, uint8_t seq, const struct ble_record *rec, uint8_t *buf)
+{
+    sys_put_le16(company, &buf[0]);
+    buf[2] = BLE_ADV_RECORD_VERSION;
+    buf[3] = seq;
+    sys_put_le16(rec->soc, &buf[4]);
+    sys_put_le16(rec->vbat, &buf[6]);
+    sys_put_le16((uint16_t)rec->boost, &buf[8]);
+    sys_put_le16((uint16_t)rec->lsldo, &buf[10]);
+
+    return BLE_ADV_RECORD_LEN;
+}
+
+#endif
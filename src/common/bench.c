@@ -0,0 +1,189 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * bench.c
+ * micro-benchmark harness for the hot paths, min/median/p99 per case through the shell and a log line.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+
+#if !defined(CONFIG_BOARD_NATIVE_SIM)
+#include <zephyr/timing/timing.h>
+#endif
+
+#include "bench.h"
+
+LOG_MODULE_REGISTER(bench, LOG_LEVEL_INF);
+
+#define BENCH_MAX_RESULTS 8
+
+static uint32_t samples[CONFIG_BENCH_MAX_ITERATIONS];
+static struct bench_result results[BENCH_MAX_RESULTS];
+static size_t results_len;
+static K_MUTEX_DEFINE(bench_lock);
+
+#if defined(CONFIG_BOARD_NATIVE_SIM)
+
+#define BENCH_UNIT "ns"
+
+// src/sim/bench_host_clock.c, built into the host side of the native_sim executable
+uint64_t bench_host_clock_ns(void);
+
+static void bench_clock_start(void)
+{
+}
+
+static uint64_t bench_clock_get(void)
+{
+    return bench_host_clock_ns();
+}
+
+static uint32_t bench_clock_delta(uint64_t start, uint64_t end)
+{
+    return (uint32_t)MIN(end - start, UINT32_MAX);
+}
+
+#else
+
+#define BENCH_UNIT "cycles"
+
+// CONFIG_CORTEX_M_DWT makes the timing API count CPU cycles with the DWT
+static void bench_clock_start(void)
+{
+    timing_init();
+    timing_start();
+}
+
+static uint64_t bench_clock_get(void)
+{
+    return timing_counter_get();
+}
+
+static uint32_t bench_clock_delta(uint64_t start, uint64_t end)
+{
+    timing_t t0 = start;
+    timing_t t1 = end;
+
+    return (uint32_t)MIN(timing_cycles_get(&t0, &t1), UINT32_MAX);
+}
+
+#endif
+
+static int bench_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void bench_store(const struct bench_result *res)
+{
+    size_t i;
+
+    for (i = 0; i < results_len && results[i].name != res->name; i++)
+    {
+    }
+    if (i == ARRAY_SIZE(results))
+    {
+        return;
+    }
+    results[i] = *res;
+    results_len = MAX(results_len, i + 1);
+}
+
+int bench_measure(const char *name, bench_fn_t prepare, bench_fn_t fn, void *ctx, uint32_t iterations)
+{
+    struct bench_result res = {.name = name};
+    int err = 0;
+
+    iterations = CLAMP(iterations, 1, ARRAY_SIZE(samples));
+
+    k_mutex_lock(&bench_lock, K_FOREVER);
+    bench_clock_start();
+    for (uint32_t i = 0; i < iterations && err >= 0; i++)
+    {
+        err = prepare ? prepare(ctx) : 0;
+        if (err < 0)
+        {
+            break;
+        }
+
+        uint64_t start = bench_clock_get();
+
+        err = fn(ctx);
+        samples[i] = bench_clock_delta(start, bench_clock_get());
+        res.iterations = i + 1;
+    }
+
+    if (err < 0)
+    {
+        k_mutex_unlock(&bench_lock);
+        LOG_ERR("%s failed after %u iterations (%d)", name, res.iterations, err);
+        return err;
+    }
+
+    qsort(samples, res.iterations, sizeof(samples[0]), bench_cmp);
+    res.min = samples[0];
+    res.median = samples[res.iterations / 2];
+    res.p99 = samples[DIV_ROUND_UP(res.iterations * 99, 100) - 1];
+    res.max = samples[res.iterations - 1];
+    bench_store(&res);
+    k_mutex_unlock(&bench_lock);
+
+    // printk rather than a deferred log, so no line is dropped when a whole suite runs
+    printk("BENCH %s unit=%s n=%u min=%u median=%u p99=%u max=%u\n", name, BENCH_UNIT, res.iterations, res.min,
+           res.median, res.p99, res.max);
+    return 0;
+}
+
+#if defined(CONFIG_SHELL)
+
+static int cmd_bench_run(const struct shell *sh, size_t argc, char **argv)
+{
+    uint32_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : CONFIG_BENCH_DEFAULT_ITERATIONS;
+    int (*const suites[])(uint32_t) = {pmic_bench, npm_adc_bench, ble_bench};
+
+    for (size_t i = 0; i < ARRAY_SIZE(suites); i++)
+    {
+        int err = suites[i](iterations);
+
+        if (err == -EAGAIN)
+        {
+            shell_warn(sh, "some cases skipped, see the log");
+        }
+        else if (err < 0)
+        {
+            shell_error(sh, "suite %d failed (%d)", (int)i, err);
+        }
+    }
+    return 0;
+}
+
+static int cmd_bench_show(const struct shell *sh, size_t argc, char **argv)
+{
+    k_mutex_lock(&bench_lock, K_FOREVER);
+    shell_print(sh, "%-16s %6s %10s %10s %10s %10s  (%s)", "case", "n", "min", "median", "p99", "max", BENCH_UNIT);
+    for (size_t i = 0; i < results_len; i++)
+    {
+        const struct bench_result *r = &results[i];
+
+        shell_print(sh, "%-16s %6u %10u %10u %10u %10u", r->name, r->iterations, r->min, r->median, r->p99, r->max);
+    }
+    k_mutex_unlock(&bench_lock);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_bench,
+                               SHELL_CMD_ARG(run, NULL, "[iterations]: time every hot path", cmd_bench_run, 1, 1),
+                               SHELL_CMD(show, NULL, "Results of the last run", cmd_bench_show), SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(bench, &sub_bench, "Hot path micro-benchmarks", NULL);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Micro-benchmarks of the hot paths, CONFIG_BENCH only (overlay-bench.conf). Each case is timed
+ * call by call, with the DWT cycle counter on hardware (unit "cycles") and the host's monotonic
+ * clock on native_sim (unit "ns", simulated time does not advance while code runs).
+ *
+ * Every result is also printed as one machine readable line, compared against the checked in
+ * baseline by scripts/bench_compare.py:
+ *   BENCH <case> unit=<cycles|ns> n=<iterations> min=<v> median=<v> p99=<v> max=<v>
+ */
+
+struct bench_result
+{
+    const char *name;
+    uint32_t iterations;
+    uint32_t min;
+    uint32_t median;
+    uint32_t p99;
+    uint32_t max;
+};
+
+// one call of the path under test, a negative return aborts the case
+typedef int (*bench_fn_t)(void *ctx);
+
+/* Time iterations calls of fn (at most CONFIG_BENCH_MAX_ITERATIONS), report and keep the result.
+ * prepare (optional) runs untimed before every call, e.g. to wait for the previous one to drain.
+ */
+int bench_measure(const char *name, bench_fn_t prepare, bench_fn_t fn, void *ctx, uint32_t iterations);
+
+// cases owned by the modules, they take their own locks and skip (-EAGAIN) what cannot run yet
+int pmic_bench(uint32_t iterations);
+int npm_adc_bench(uint32_t iterations);
+int ble_bench(uint32_t iterations);
+
+#endif
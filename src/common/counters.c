@@ -0,0 +1,109 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * counters.c
+ * per-module event counters, exported over BLE for power profiling.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include "counters.h"
+
+#define COUNTERS_HDR_LEN 6
+
+atomic_t counters[COUNTER_COUNT];
+
+static struct k_spinlock radio_lock;
+static struct
+{
+    enum counters_radio_state state;
+    uint32_t event_ms; // effective time between radio events
+    int64_t since;
+    uint32_t remainder_ms; // time not yet worth a whole event
+} radio[COUNTERS_RADIO_SLOTS];
+
+static uint32_t export_base[COUNTER_COUNT];
+static int64_t export_since;
+
+// must be called with radio_lock held
+static void counters_radio_fold(int64_t now)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(radio); i++)
+    {
+        if (radio[i].state != COUNTERS_RADIO_IDLE && radio[i].event_ms)
+        {
+            uint64_t elapsed = (uint64_t)(now - radio[i].since) + radio[i].remainder_ms;
+            enum counter_id id =
+                (radio[i].state == COUNTERS_RADIO_CONNECTED) ? COUNTER_CONN_EVENT : COUNTER_ADV_EVENT;
+
+            counter_add(id, (uint32_t)(elapsed / radio[i].event_ms));
+            radio[i].remainder_ms = elapsed % radio[i].event_ms;
+        }
+        else
+        {
+            radio[i].remainder_ms = 0;
+        }
+        radio[i].since = now;
+    }
+}
+
+void counters_set_radio_state(size_t slot, enum counters_radio_state state, uint32_t interval_ms, uint16_t latency)
+{
+    if (slot >= ARRAY_SIZE(radio))
+    {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&radio_lock);
+
+    counters_radio_fold(k_uptime_get());
+    radio[slot].state = state;
+    // with peripheral latency only every (latency + 1)th event is attended when there is nothing to send
+    radio[slot].event_ms = interval_ms * (latency + 1);
+    radio[slot].remainder_ms = 0;
+    k_spin_unlock(&radio_lock, key);
+}
+
+void counters_totals(uint32_t out[COUNTER_COUNT])
+{
+    k_spinlock_key_t key = k_spin_lock(&radio_lock);
+
+    counters_radio_fold(k_uptime_get());
+    k_spin_unlock(&radio_lock, key);
+
+    for (size_t i = 0; i < COUNTER_COUNT; i++)
+    {
+        out[i] = (uint32_t)atomic_get(&counters[i]);
+    }
+}
+
+size_t counters_export(uint8_t *buf, size_t size)
+{
+    uint32_t totals[COUNTER_COUNT];
+    size_t len = COUNTERS_HDR_LEN + COUNTER_COUNT * sizeof(uint32_t);
+
+    if (size < len)
+    {
+        return 0;
+    }
+
+    counters_totals(totals);
+    buf[0] = COUNTERS_VERSION;
+    buf[1] = COUNTER_COUNT;
+    sys_put_le32((uint32_t)(k_uptime_get() - export_since), &buf[2]);
+    for (size_t i = 0; i < COUNTER_COUNT; i++)
+    {
+        sys_put_le32(totals[i] - export_base[i], &buf[COUNTERS_HDR_LEN + i * sizeof(uint32_t)]);
+    }
+
+    return len;
+}
+
+void counters_export_reset(void)
+{
+    counters_totals(export_base);
+    export_since = k_uptime_get();
+}
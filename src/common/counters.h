@@ -0,0 +1,69 @@
+#ifndef COUNTERS_H_
+#define COUNTERS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/sys/atomic.h>
+
+#define COUNTERS_VERSION 1
+
+/* Event counters for correlating power profiler traces with firmware activity.
+ * Never reset internally, consumers (energy estimator, BLE export) keep their own baseline.
+ */
+enum counter_id
+{
+    COUNTER_PMIC_FETCH,   // nPM2100 sensor fetch (I2C) in read_sensors()
+    COUNTER_REG_SET,      // LSLDO regulator set (I2C) in pmic_reg_thread()
+    COUNTER_ADC_BLOCK,    // completed ADC sequence
+    COUNTER_ADC_SAMPLE,   // SAADC sampling of both channels
+    COUNTER_BLE_NOTIFY,   // notification accepted by bt_gatt_notify_cb()
+    COUNTER_BLE_TX_BYTES, // notification payload bytes
+    COUNTER_ADV_EVENT,    // advertising events, derived from the advertising interval
+    COUNTER_CONN_EVENT,   // attended connection events, derived from interval and latency
+    COUNTER_ADC_CAL,      // SAADC offset calibration
+    COUNTER_PMIC_EVENT,   // nPM2100 interrupt with a subscribed event (the MFD reads and clears the events over I2C)
+    COUNTER_COUNT,
+};
+
+enum counters_radio_state
+{
+    COUNTERS_RADIO_IDLE,
+    COUNTERS_RADIO_ADVERTISING,
+    COUNTERS_RADIO_CONNECTED,
+};
+
+extern atomic_t counters[COUNTER_COUNT];
+
+// one atomic add, cheap enough for every event
+static inline void counter_add(enum counter_id id, uint32_t n)
+{
+    (void)atomic_add(&counters[id], (atomic_val_t)n);
+}
+
+static inline void counter_inc(enum counter_id id)
+{
+    (void)atomic_inc(&counters[id]);
+}
+
+/* Radio events are not observable from the host one by one, they are counted from the time
+ * spent advertising or connected and the current interval. The advertiser and every
+ * connection have their own slot.
+ */
+#define COUNTERS_RADIO_SLOT_ADV 0
+#define COUNTERS_RADIO_SLOT_PER_ADV 1             // periodic advertising train, if enabled
+#define COUNTERS_RADIO_SLOT_LINK(idx) (2 + (idx)) // idx from bt_conn_index()
+#define COUNTERS_RADIO_SLOTS (2 + CONFIG_BT_MAX_CONN)
+
+void counters_set_radio_state(size_t slot, enum counters_radio_state state, uint32_t interval_ms, uint16_t latency);
+
+// running totals since boot, radio events folded in up to now
+void counters_totals(uint32_t out[COUNTER_COUNT]);
+
+/* Compact export: [version u8][count u8][window ms u32][count x u32], little endian.
+ * The values are deltas since the last export reset. Returns the length used.
+ */
+size_t counters_export(uint8_t *buf, size_t size);
+void counters_export_reset(void);
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * diag.c
+ * thread runtime, stack high-water and queue depth diagnostics, for the DIAG characteristic and the shell.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include "diag.h"
+
+#define DIAG_HDR_LEN 9
+#define DIAG_MSGQ_ENTRY_LEN 2
+#define DIAG_THREAD_ENTRY_LEN (DIAG_NAME_LEN + 10)
+
+struct diag_msgq_stat
+{
+    uint8_t peak;
+    uint8_t capacity;
+};
+
+static struct diag_msgq_stat msgq_stats[DIAG_MSGQ_COUNT];
+
+struct diag_thread_info
+{
+    char name[DIAG_NAME_LEN + 1];
+    uint32_t runtime_ms;
+    uint16_t cpu_permille;
+    uint16_t stack_size;
+    uint16_t stack_unused;
+};
+
+typedef void (*diag_thread_visit_t)(const struct diag_thread_info *info, void *user_data);
+
+struct diag_walk
+{
+    uint64_t total_cycles;
+    diag_thread_visit_t visit;
+    void *user_data;
+};
+
+void diag_msgq_sample(enum diag_msgq id, struct k_msgq *q)
+{
+    uint32_t used = k_msgq_num_used_get(q);
+
+    msgq_stats[id].capacity = q->max_msgs;
+    if (used > msgq_stats[id].peak)
+    {
+        msgq_stats[id].peak = used;
+    }
+}
+
+static void diag_thread_cb(const struct k_thread *cthread, void *user_data)
+{
+    struct k_thread *thread = (struct k_thread *)cthread;
+    struct diag_walk *walk = user_data;
+    struct diag_thread_info info = {0};
+    k_thread_runtime_stats_t stats;
+    size_t unused = 0;
+    const char *name = k_thread_name_get(thread);
+
+    snprintf(info.name, sizeof(info.name), "%s", (name && name[0]) ? name : "?");
+    if (!k_thread_runtime_stats_get(thread, &stats))
+    {
+        info.runtime_ms = (uint32_t)k_cyc_to_ms_floor64(stats.execution_cycles);
+        if (walk->total_cycles)
+        {
+            info.cpu_permille = (uint16_t)(stats.execution_cycles * 1000 / walk->total_cycles);
+        }
+    }
+    info.stack_size = (uint16_t)MIN(thread->stack_info.size, UINT16_MAX);
+    if (!k_thread_stack_space_get(thread, &unused))
+    {
+        info.stack_unused = (uint16_t)MIN(unused, UINT16_MAX);
+    }
+
+    walk->visit(&info, walk->user_data);
+}
+
+// visit every thread, returns the idle share of the CPU since boot in permille
+static uint16_t diag_walk_threads(diag_thread_visit_t visit, void *user_data)
+{
+    k_thread_runtime_stats_t all;
+    struct diag_walk walk = {.visit = visit, .user_data = user_data};
+    uint16_t idle_permille = 0;
+
+    if (!k_thread_runtime_stats_all_get(&all) && all.execution_cycles)
+    {
+        walk.total_cycles = all.execution_cycles;
+        idle_permille = (uint16_t)(all.idle_cycles * 1000 / all.execution_cycles);
+    }
+
+    /* the stack scan in diag_thread_cb is slow, do not hold the thread monitor lock (and block thread
+     * creation and exit) for it. A thread that exits meanwhile is simply missing from this walk.
+     */
+    k_thread_foreach_unlocked(diag_thread_cb, &walk);
+    return idle_permille;
+}
+
+struct diag_encode_ctx
+{
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    uint8_t count;
+};
+
+static void diag_encode_thread(const struct diag_thread_info *info, void *user_data)
+{
+    struct diag_encode_ctx *ctx = user_data;
+    uint8_t *p = &ctx->buf[ctx->len];
+
+    if (ctx->len + DIAG_THREAD_ENTRY_LEN > ctx->size || ctx->count == UINT8_MAX)
+    {
+        return; // value full, the remaining threads are dropped
+    }
+
+    memset(p, 0, DIAG_NAME_LEN);
+    memcpy(p, info->name, strnlen(info->name, DIAG_NAME_LEN));
+    sys_put_le32(info->runtime_ms, &p[DIAG_NAME_LEN]);
+    sys_put_le16(info->cpu_permille, &p[DIAG_NAME_LEN + 4]);
+    sys_put_le16(info->stack_size, &p[DIAG_NAME_LEN + 6]);
+    sys_put_le16(info->stack_unused, &p[DIAG_NAME_LEN + 8]);
+    ctx->len += DIAG_THREAD_ENTRY_LEN;
+    ctx->count++;
+}
+
+size_t diag_encode(uint8_t *buf, size_t size)
+{
+    size_t hdr_len = DIAG_HDR_LEN + DIAG_MSGQ_COUNT * DIAG_MSGQ_ENTRY_LEN;
+    struct diag_encode_ctx ctx = {.buf = buf, .size = size, .len = hdr_len};
+    uint16_t idle_permille;
+
+    if (size < hdr_len)
+    {
+        return 0;
+    }
+
+    idle_permille = diag_walk_threads(diag_encode_thread, &ctx);
+
+    buf[0] = DIAG_VERSION;
+    buf[1] = ctx.count;
+    sys_put_le16(idle_permille, &buf[2]);
+    sys_put_le32(k_uptime_get_32(), &buf[4]);
+    buf[8] = DIAG_MSGQ_COUNT;
+    for (size_t i = 0; i < DIAG_MSGQ_COUNT; i++)
+    {
+        buf[DIAG_HDR_LEN + i * DIAG_MSGQ_ENTRY_LEN] = msgq_stats[i].peak;
+        buf[DIAG_HDR_LEN + i * DIAG_MSGQ_ENTRY_LEN + 1] = msgq_stats[i].capacity;
+    }
+
+    return ctx.len;
+}
+
+#if defined(CONFIG_SHELL)
+static const char *const msgq_str[] = {
+    [DIAG_MSGQ_BLE_CFG_PMIC] = "ble_cfg_pmic",
+};
+
+static void diag_print_thread(const struct diag_thread_info *info, void *user_data)
+{
+    const struct shell *sh = user_data;
+
+    shell_print(sh, "%-12s %10u %5u.%u %6u %6u", info->name, info->runtime_ms, info->cpu_permille / 10,
+                info->cpu_permille % 10, info->stack_size, info->stack_size - info->stack_unused);
+}
+
+static int cmd_diag(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "%-12s %10s %7s %6s %6s", "thread", "run ms", "cpu %", "stack", "peak");
+    uint16_t idle_permille = diag_walk_threads(diag_print_thread, (void *)sh);
+
+    shell_print(sh, "idle: %u.%u %%", idle_permille / 10, idle_permille % 10);
+    for (size_t i = 0; i < DIAG_MSGQ_COUNT; i++)
+    {
+        shell_print(sh, "msgq %s: peak %u of %u", msgq_str[i], msgq_stats[i].peak, msgq_stats[i].capacity);
+    }
+    return 0;
+}
+
+SHELL_CMD_REGISTER(diag, NULL, "Thread runtime, stack high-water and queue depth diagnostics", cmd_diag);
+#endif
@@ -0,0 +1,32 @@
+#ifndef DIAG_H_
+#define DIAG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+#define DIAG_VERSION 1
+#define DIAG_NAME_LEN 12
+
+/*
+ * DIAG characteristic value, little endian, read with long reads:
+ * header  [version u8][thread count u8][idle permille u16][uptime ms u32]
+ *         [msgq count u8] then per queue [peak used u8][capacity u8]
+ * then per thread, 22 bytes:
+ *         [name, 12 bytes, zero padded][runtime ms u32][cpu permille u16][stack size u16][stack unused u16]
+ */
+
+// message queues whose peak depth is tracked
+enum diag_msgq
+{
+    DIAG_MSGQ_BLE_CFG_PMIC,
+    DIAG_MSGQ_COUNT,
+};
+
+// record the fill level of a queue right after a put
+void diag_msgq_sample(enum diag_msgq id, struct k_msgq *q);
+
+// encode the diagnostics value into buf, returns the length used
+size_t diag_encode(uint8_t *buf, size_t size);
+
+#endif
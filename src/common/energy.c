@@ -0,0 +1,102 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * energy.c
+ * energy accounting, estimates the average battery current from firmware activity.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#include "counters.h"
+#include "energy.h"
+
+LOG_MODULE_REGISTER(energy, LOG_LEVEL_INF);
+
+#define NC_PER_UC 1000
+
+static uint32_t last_counters[COUNTER_COUNT];
+static int64_t last_estimate;
+static uint64_t last_active_cycles;
+static struct energy_breakdown breakdown;
+
+static uint64_t energy_cpu_active_cycles(void)
+{
+    k_thread_runtime_stats_t stats;
+
+    if (k_thread_runtime_stats_all_get(&stats))
+    {
+        return 0;
+    }
+    return stats.total_cycles; // non-idle cycles
+}
+
+float energy_average_current(float vbat, int32_t boost_mv, int32_t lsldo_mv)
+{
+    int64_t now = k_uptime_get();
+    int64_t dt_ms = now - last_estimate;
+    uint32_t totals[COUNTER_COUNT];
+    uint64_t events[COUNTER_COUNT];
+
+    if (dt_ms <= 0 || vbat <= 0.f || boost_mv <= 0)
+    {
+        return (float)CONFIG_ENERGY_SLEEP_UA * 1e-6f;
+    }
+
+    counters_totals(totals);
+    for (size_t i = 0; i < COUNTER_COUNT; i++)
+    {
+        events[i] = totals[i] - last_counters[i];
+        last_counters[i] = totals[i];
+    }
+
+    uint64_t active_cycles = energy_cpu_active_cycles();
+    uint64_t active_us = k_cyc_to_us_floor64(active_cycles - last_active_cycles);
+    last_active_cycles = active_cycles;
+
+    // charge drawn from the BOOST output over the interval, in nC (uA * ms = nC)
+    uint64_t sleep_nc = (uint64_t)CONFIG_ENERGY_SLEEP_UA * dt_ms;
+    uint64_t cpu_nc = (uint64_t)CONFIG_ENERGY_CPU_ACTIVE_UA * active_us / USEC_PER_MSEC;
+    uint64_t adc_nc = events[COUNTER_ADC_SAMPLE] * CONFIG_ENERGY_ADC_SAMPLE_NC +
+                      events[COUNTER_ADC_CAL] * CONFIG_ENERGY_ADC_CAL_NC;
+    // an event costs the MFD an events read and a clear
+    uint64_t pmic_nc = (events[COUNTER_PMIC_FETCH] + events[COUNTER_REG_SET] + 2 * events[COUNTER_PMIC_EVENT]) *
+                       CONFIG_ENERGY_PMIC_XFER_NC;
+    uint64_t radio_nc = events[COUNTER_ADV_EVENT] * CONFIG_ENERGY_ADV_EVENT_NC +
+                        events[COUNTER_CONN_EVENT] * CONFIG_ENERGY_CONN_EVENT_NC +
+                        events[COUNTER_BLE_TX_BYTES] * CONFIG_ENERGY_BLE_TX_BYTE_NC;
+    uint64_t lsldo_nc = 0;
+
+    // the LDO/LS output is fed from BOOST, its load is the measured rail voltage over the configured load
+    if (CONFIG_ENERGY_LSLDO_LOAD_OHMS > 0 && lsldo_mv > 0)
+    {
+        lsldo_nc = (uint64_t)lsldo_mv * 1000 / CONFIG_ENERGY_LSLDO_LOAD_OHMS * dt_ms;
+    }
+
+    uint64_t total_nc = sleep_nc + cpu_nc + adc_nc + pmic_nc + radio_nc + lsldo_nc;
+
+    breakdown.sleep_uc += sleep_nc / NC_PER_UC;
+    breakdown.cpu_uc += cpu_nc / NC_PER_UC;
+    breakdown.adc_uc += adc_nc / NC_PER_UC;
+    breakdown.pmic_uc += pmic_nc / NC_PER_UC;
+    breakdown.radio_uc += radio_nc / NC_PER_UC;
+    breakdown.lsldo_uc += lsldo_nc / NC_PER_UC;
+    last_estimate = now;
+
+    // average output current, then refer it to the battery through the boost converter
+    float i_out = (float)total_nc * 1e-9f / ((float)dt_ms / 1000.f);
+    float i_batt = i_out * ((float)boost_mv / 1000.f) / (vbat * (CONFIG_ENERGY_BOOST_EFFICIENCY_PCT / 100.f));
+
+    LOG_DBG("%d ms: sleep %u cpu %u adc %u pmic %u radio %u lsldo %u nC -> %d uA", (int)dt_ms, (uint32_t)sleep_nc,
+            (uint32_t)cpu_nc, (uint32_t)adc_nc, (uint32_t)pmic_nc, (uint32_t)radio_nc, (uint32_t)lsldo_nc,
+            (int)(i_batt * 1e6f));
+
+    return i_batt;
+}
+
+void energy_get_breakdown(struct energy_breakdown *out)
+{
+    *out = breakdown;
+}
@@ -0,0 +1,25 @@
+#ifndef ENERGY_H_
+#define ENERGY_H_
+
+#include <stdint.h>
+
+// where the estimated charge went, cumulative since boot, in uC
+struct energy_breakdown
+{
+    uint32_t sleep_uc;
+    uint32_t cpu_uc;
+    uint32_t adc_uc;
+    uint32_t pmic_uc;
+    uint32_t radio_uc;
+    uint32_t lsldo_uc;
+};
+
+/* Average battery current in A since the previous call, for nrf_fuel_gauge_process.
+ * Activity comes from the event counters (counters.h), each event priced by the ENERGY_*_NC options.
+ * The load is estimated at the BOOST output (boost_mv) and referred back to the battery.
+ */
+float energy_average_current(float vbat, int32_t boost_mv, int32_t lsldo_mv);
+
+void energy_get_breakdown(struct energy_breakdown *out);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef FIXED_POINT_H_
+#define FIXED_POINT_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Telemetry travels as scaled integers (mV, 0.01 %, 0.01 deg C) so no double precision or
+ * FP printf is needed. These print them with their decimals, e.g.
+ * LOG_INF("T: " CENTI_FMT " C", CENTI_ARGS(temp));
+ */
+#define CENTI_FMT "%s%d.%02d"
+#define CENTI_ARGS(v) ((v) < 0 ? "-" : ""), abs((int)(v)) / 100, abs((int)(v)) % 100
+#define MILLI_FMT "%s%d.%03d"
+#define MILLI_ARGS(v) ((v) < 0 ? "-" : ""), abs((int)(v)) / 1000, abs((int)(v)) % 1000
+
+// q31 value with a shift (struct sensor_q31_data) in units of 1/scale, e.g. scale 1000 for mV
+static inline int32_t q31_to_scaled_i32(int32_t value, int8_t shift, int32_t scale)
+{
+    int64_t x = (int64_t)value * scale;
+
+    return (int32_t)(shift <= 31 ? x >> (31 - shift) : x << (shift - 31));
+}
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * pipeline.c
+ * timer driven execution mode, one workqueue runs sample, fuel gauge and notify per tick.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "ble_periph_pmic.h"
+#include "npm_adc.h"
+#include "pipeline.h"
+#include "pmic.h"
+#include "sched.h"
+
+LOG_MODULE_REGISTER(pipeline, LOG_LEVEL_INF);
+
+K_THREAD_STACK_DEFINE(pipeline_stack, CONFIG_PIPELINE_STACK_SIZE);
+static struct k_work_q pipeline_q;
+
+static void pipeline_tick(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(tick_work, pipeline_tick);
+static void pipeline_setpoint(struct k_work *work);
+static K_WORK_DEFINE(setpoint_work, pipeline_setpoint);
+
+// run order within a tick, the fuel gauge uses the fresh ADC block and notify uses both
+static const struct
+{
+    enum sched_stage stage;
+    const char *name;
+    int (*step)(void);
+    int (*prefetch)(void); // started before any step runs, so its I/O overlaps the earlier steps
+} steps[] = {
+    {SCHED_STAGE_ADC, "adc", npm_adc_step, NULL},
+    {SCHED_STAGE_FG, "fuel gauge", pmic_fg_step, pmic_fg_prefetch},
+    {SCHED_STAGE_NOTIFY, "notify", ble_publish, NULL},
+};
+
+// only touched on the pipeline queue, except the stats copy
+static int64_t next_due[SCHED_STAGE_COUNT];
+static atomic_t wake_pending;
+static struct k_spinlock stats_lock;
+static struct pipeline_stats stats;
+
+// a stage became hot, run it now instead of at the end of its backed off period
+static void pipeline_wake(enum sched_stage stage)
+{
+    atomic_set_bit(&wake_pending, stage);
+    k_work_reschedule_for_queue(&pipeline_q, &tick_work, K_NO_WAIT);
+}
+
+static void pipeline_tick(struct k_work *work)
+{
+    int64_t now = k_uptime_get();
+    int64_t next = INT64_MAX;
+    uint32_t due = 0;
+    uint32_t ran = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(steps); i++)
+    {
+        enum sched_stage stage = steps[i].stage;
+
+        if (atomic_test_and_clear_bit(&wake_pending, stage))
+        {
+            next_due[stage] = now;
+        }
+        if (next_due[stage] - now > CONFIG_PIPELINE_ALIGN_MS)
+        {
+            next = MIN(next, next_due[stage]);
+            continue;
+        }
+        due |= BIT(i);
+        if (steps[i].prefetch)
+        {
+            (void)steps[i].prefetch();
+        }
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(steps); i++)
+    {
+        enum sched_stage stage = steps[i].stage;
+
+        if (!(due & BIT(i)))
+        {
+            continue;
+        }
+
+        uint32_t start = k_cycle_get_32();
+        int err = steps[i].step();
+        uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+        if (err < 0)
+        {
+            LOG_WRN("%s stage failed (%d)", steps[i].name, err);
+        }
+        LOG_DBG("%s stage took %u us", steps[i].name, us);
+
+        k_spinlock_key_t key = k_spin_lock(&stats_lock);
+        struct pipeline_stage_stats *st = &stats.stage[stage];
+        st->runs++;
+        st->last_us = us;
+        st->max_us = MAX(st->max_us, us);
+        st->total_us += us;
+        k_spin_unlock(&stats_lock, key);
+
+        // periods are counted from the tick, so stages that ran together stay together
+        next_due[stage] = now + sched_advance(stage);
+        next = MIN(next, next_due[stage]);
+        ran++;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    stats.ticks++;
+    stats.stage_runs += ran;
+    k_spin_unlock(&stats_lock, key);
+
+    k_work_reschedule_for_queue(&pipeline_q, &tick_work, K_MSEC(MAX(next - k_uptime_get(), 0)));
+}
+
+static void pipeline_setpoint(struct k_work *work)
+{
+    int32_t requested_lsldo_mv;
+
+    while (k_msgq_get(&ble_cfg_pmic_msgq, &requested_lsldo_mv, K_NO_WAIT) == 0)
+    {
+        pmic_lsldo_set(requested_lsldo_mv);
+    }
+}
+
+void pipeline_submit_setpoint(void)
+{
+    k_work_submit_to_queue(&pipeline_q, &setpoint_work);
+}
+
+void pipeline_get_stats(struct pipeline_stats *out)
+{
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+    *out = stats;
+    k_spin_unlock(&stats_lock, key);
+}
+
+int pipeline_start(void)
+{
+    const struct k_work_queue_config cfg = {.name = "pipeline"};
+    int err;
+
+    k_work_queue_start(&pipeline_q, pipeline_stack, K_THREAD_STACK_SIZEOF(pipeline_stack), CONFIG_PIPELINE_PRIORITY,
+                       &cfg);
+
+    err = pmic_init();
+    if (err < 0)
+    {
+        return err;
+    }
+    err = npm_adc_init();
+    if (err < 0)
+    {
+        return err;
+    }
+    err = bt_init();
+    if (err != 0)
+    {
+        LOG_ERR("unable to initialize BLE!");
+    }
+
+    sched_set_wake_cb(pipeline_wake);
+    // every next_due is 0, the first tick runs all stages together
+    k_work_reschedule_for_queue(&pipeline_q, &tick_work, K_NO_WAIT);
+    LOG_INF("Pipeline started, stages within %d ms share a tick", CONFIG_PIPELINE_ALIGN_MS);
+
+    return 0;
+}
+
+#if defined(CONFIG_SHELL)
+
+static int cmd_pipeline(const struct shell *sh, size_t argc, char **argv)
+{
+    struct pipeline_stats s;
+
+    pipeline_get_stats(&s);
+    shell_print(sh, "%-12s %8s %8s %8s %8s", "stage", "runs", "last us", "avg us", "max us");
+    for (size_t i = 0; i < ARRAY_SIZE(steps); i++)
+    {
+        const struct pipeline_stage_stats *st = &s.stage[steps[i].stage];
+
+        shell_print(sh, "%-12s %8u %8u %8u %8u", steps[i].name, st->runs, st->last_us,
+                    st->runs ? (uint32_t)(st->total_us / st->runs) : 0, st->max_us);
+    }
+    shell_print(sh, "ticks: %u, stages per tick: %u.%02u", s.ticks, s.ticks ? s.stage_runs / s.ticks : 0,
+                s.ticks ? (s.stage_runs * 100 / s.ticks) % 100 : 0);
+    return 0;
+}
+
+SHELL_CMD_REGISTER(pipeline, NULL, "Pipeline stage timing", cmd_pipeline);
+
+#endif
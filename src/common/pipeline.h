@@ -0,0 +1,36 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdint.h>
+
+#include "sched.h"
+
+/* Single workqueue that runs ADC -> fuel gauge -> notify as one pass per tick, instead of
+ * the ADC, fuel gauge, regulator and BLE threads. Stages that fall due within
+ * CONFIG_PIPELINE_ALIGN_MS of each other share a wakeup.
+ */
+
+struct pipeline_stage_stats
+{
+    uint32_t runs;
+    uint32_t last_us;
+    uint32_t max_us;
+    uint64_t total_us;
+};
+
+struct pipeline_stats
+{
+    uint32_t ticks;
+    uint32_t stage_runs; // stage_runs / ticks is the number of stages sharing a wakeup
+    struct pipeline_stage_stats stage[SCHED_STAGE_COUNT];
+};
+
+// initialise the PMIC, ADC and BLE and start ticking, called from main
+int pipeline_start(void);
+
+// apply the queued LSLDO setpoint requests on the pipeline queue
+void pipeline_submit_setpoint(void);
+
+void pipeline_get_stats(struct pipeline_stats *stats);
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * rtpm.c
+ * device runtime PM of the SAADC and the nPM2100 TWI between acquisitions, with residency and resume latency stats.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/pm/device_runtime.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+#include "rtpm.h"
+
+LOG_MODULE_REGISTER(rtpm, LOG_LEVEL_INF);
+
+struct rtpm_entry
+{
+    const struct device *dev;
+    const char *name;
+    uint32_t users;        // application references, the driver may hold its own
+    uint64_t active_since; // cycles, valid while users > 0
+    struct rtpm_stats stats;
+};
+
+static struct rtpm_entry entries[RTPM_COUNT] = {
+    [RTPM_SAADC] = {.dev = DEVICE_DT_GET(DT_IO_CHANNELS_CTLR_BY_IDX(DT_PATH(zephyr_user), 0)), .name = "saadc"},
+    [RTPM_TWI] = {.dev = DEVICE_DT_GET(DT_BUS(DT_NODELABEL(npm2100ek_pmic))), .name = "twi"},
+};
+static struct k_spinlock rtpm_lock;
+
+int rtpm_get(enum rtpm_dev id)
+{
+    struct rtpm_entry *e = &entries[id];
+    enum pm_device_state state = PM_DEVICE_STATE_ACTIVE;
+
+    (void)pm_device_state_get(e->dev, &state);
+
+    uint64_t start = k_cycle_get_64();
+    int err = pm_device_runtime_get(e->dev);
+    uint64_t now = k_cycle_get_64();
+
+    if (err < 0)
+    {
+        LOG_ERR("Could not resume %s (%d)", e->name, err);
+        return err;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&rtpm_lock);
+    if (e->users++ == 0)
+    {
+        e->active_since = now;
+    }
+    if (state == PM_DEVICE_STATE_SUSPENDED)
+    {
+        uint32_t us = (uint32_t)k_cyc_to_us_ceil64(now - start);
+
+        e->stats.resumes++;
+        e->stats.last_resume_us = us;
+        e->stats.max_resume_us = MAX(e->stats.max_resume_us, us);
+        e->stats.total_resume_us += us;
+    }
+    k_spin_unlock(&rtpm_lock, key);
+    return 0;
+}
+
+void rtpm_put(enum rtpm_dev id)
+{
+    struct rtpm_entry *e = &entries[id];
+
+    k_spinlock_key_t key = k_spin_lock(&rtpm_lock);
+    if (e->users == 0)
+    {
+        k_spin_unlock(&rtpm_lock, key);
+        LOG_ERR("Unbalanced put of %s", e->name);
+        return;
+    }
+    if (--e->users == 0)
+    {
+        e->stats.active_us += k_cyc_to_us_floor64(k_cycle_get_64() - e->active_since);
+    }
+    k_spin_unlock(&rtpm_lock, key);
+
+    int err = pm_device_runtime_put(e->dev);
+    if (err < 0)
+    {
+        LOG_ERR("Could not suspend %s (%d)", e->name, err);
+    }
+}
+
+void rtpm_get_stats(enum rtpm_dev id, struct rtpm_stats *out)
+{
+    const struct rtpm_entry *e = &entries[id];
+    uint64_t now = k_cycle_get_64();
+
+    k_spinlock_key_t key = k_spin_lock(&rtpm_lock);
+    *out = e->stats;
+    if (e->users)
+    {
+        out->active_us += k_cyc_to_us_floor64(now - e->active_since);
+    }
+    k_spin_unlock(&rtpm_lock, key);
+    out->window_us = k_cyc_to_us_floor64(now);
+}
+
+#if defined(CONFIG_SHELL)
+
+static int cmd_rtpm(const struct shell *sh, size_t argc, char **argv)
+{
+    shell_print(sh, "%-6s %8s %7s %9s %9s %9s %8s", "dev", "runtime", "resumes", "last us", "max us", "avg us",
+                "active");
+    for (size_t i = 0; i < RTPM_COUNT; i++)
+    {
+        struct rtpm_stats st;
+
+        rtpm_get_stats(i, &st);
+        uint32_t avg_us = st.resumes ? (uint32_t)(st.total_resume_us / st.resumes) : 0;
+        uint32_t permille = st.window_us ? (uint32_t)(st.active_us * 1000 / st.window_us) : 0;
+
+        shell_print(sh, "%-6s %8s %7u %9u %9u %9u %4u.%u %%", entries[i].name,
+                    pm_device_runtime_is_enabled(entries[i].dev) ? "on" : "off", st.resumes, st.last_resume_us,
+                    st.max_resume_us, avg_us, permille / 10, permille % 10);
+    }
+    return 0;
+}
+
+SHELL_CMD_REGISTER(rtpm, NULL, "SAADC and TWI runtime PM residency and resume latency", cmd_rtpm);
+
+#endif
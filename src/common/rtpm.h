@@ -0,0 +1,36 @@
+#ifndef RTPM_H_
+#define RTPM_H_
+
+#include <stdint.h>
+
+/* Device runtime PM of the SAADC and the nPM2100 TWI, with residency and resume latency
+ * statistics. Every acquisition is wrapped in rtpm_get()/rtpm_put(), the device is suspended
+ * as soon as the last user puts it (synchronously, not after a delay).
+ */
+
+enum rtpm_dev
+{
+    RTPM_SAADC,
+    RTPM_TWI,
+    RTPM_COUNT,
+};
+
+struct rtpm_stats
+{
+    uint32_t resumes;        // gets that found the device suspended
+    uint32_t last_resume_us; // duration of the last resuming get
+    uint32_t max_resume_us;
+    uint64_t total_resume_us;
+    uint64_t active_us; // time with at least one application reference
+    uint64_t window_us; // since boot, active_us / window_us is the active residency
+};
+
+// resume the device if needed and take a reference, returns pm_device_runtime_get()'s result
+int rtpm_get(enum rtpm_dev id);
+
+// drop the reference, the device suspends right away when it was the last one
+void rtpm_put(enum rtpm_dev id);
+
+void rtpm_get_stats(enum rtpm_dev id, struct rtpm_stats *out);
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * sched.c
+ * adaptive scheduler, sets the fuel gauge, ADC and notify periods from SoC slope and link state.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#include "sched.h"
+
+LOG_MODULE_REGISTER(sched, LOG_LEVEL_INF);
+
+#define SCHED_PERIOD_FLOOR_MS 100
+
+/* Each stage runs at its min period while the system is "hot" (central subscribed, SoC moving,
+ * regulator recently changed, nPM2100 event) and otherwise doubles its period every cycle up to its max period.
+ * While a central is connected but not subscribed, the fuel gauge and ADC stop doubling at
+ * CONFIG_SCHED_CONNECTED_PERIOD_MAX_MS, so its reads are not minutes old.
+ */
+struct sched_stage_state
+{
+    uint32_t min_ms;
+    uint32_t max_ms;
+    uint32_t period_ms;
+    struct k_sem wake;
+};
+
+static struct sched_stage_state stages[SCHED_STAGE_COUNT] = {
+    [SCHED_STAGE_FG] = {.min_ms = CONFIG_SCHED_FG_PERIOD_MIN_MS, .max_ms = CONFIG_SCHED_FG_PERIOD_MAX_MS},
+    [SCHED_STAGE_ADC] = {.min_ms = CONFIG_SCHED_ADC_PERIOD_MIN_MS, .max_ms = CONFIG_SCHED_ADC_PERIOD_MAX_MS},
+    [SCHED_STAGE_NOTIFY] = {.min_ms = CONFIG_SCHED_NOTIFY_PERIOD_MIN_MS,
+                            .max_ms = CONFIG_SCHED_NOTIFY_PERIOD_MAX_MS},
+};
+
+static const char *const stage_str[] = {
+    [SCHED_STAGE_FG] = "fuel gauge",
+    [SCHED_STAGE_ADC] = "adc",
+    [SCHED_STAGE_NOTIFY] = "notify",
+};
+
+static struct k_spinlock sched_lock;
+static bool link_connected;
+static bool link_subscribed;
+static bool soc_moving;
+static int64_t last_setpoint_change = -CONFIG_SCHED_SETPOINT_HOLD_MS;
+static int64_t last_pmic_event = -CONFIG_SCHED_EVENT_HOLD_MS;
+static int32_t anchor_soc = -1; // start of the current slope window
+static int64_t anchor_soc_time;
+static sched_wake_cb_t wake_cb;
+
+static int sched_init(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(stages); i++)
+    {
+        stages[i].period_ms = stages[i].min_ms;
+        k_sem_init(&stages[i].wake, 0, 1);
+    }
+    return 0;
+}
+
+SYS_INIT(sched_init, APPLICATION, 0);
+
+// must be called with sched_lock held
+static bool sched_stage_hot(enum sched_stage stage)
+{
+    int64_t now = k_uptime_get();
+    bool setpoint_recent = (now - last_setpoint_change) < CONFIG_SCHED_SETPOINT_HOLD_MS;
+    bool event_recent = (now - last_pmic_event) < CONFIG_SCHED_EVENT_HOLD_MS;
+
+    switch (stage)
+    {
+    case SCHED_STAGE_FG:
+        return link_subscribed || soc_moving || event_recent;
+    case SCHED_STAGE_ADC:
+        return link_subscribed || setpoint_recent;
+    case SCHED_STAGE_NOTIFY:
+        return link_subscribed || event_recent;
+    default:
+        return false;
+    }
+}
+
+/* must be called with sched_lock held. A connected central can read the telemetry at any time,
+ * so the sampling stages stay fresh enough for that even before it subscribes.
+ */
+static uint32_t sched_stage_max(enum sched_stage stage)
+{
+    const struct sched_stage_state *st = &stages[stage];
+
+    if (link_connected && stage != SCHED_STAGE_NOTIFY)
+    {
+        return CLAMP(CONFIG_SCHED_CONNECTED_PERIOD_MAX_MS, st->min_ms, st->max_ms);
+    }
+    return st->max_ms;
+}
+
+static void sched_wake(enum sched_stage stage)
+{
+    k_sem_give(&stages[stage].wake);
+    if (wake_cb)
+    {
+        wake_cb(stage);
+    }
+}
+
+void sched_set_wake_cb(sched_wake_cb_t cb)
+{
+    wake_cb = cb;
+}
+
+struct k_sem *sched_wake_sem(enum sched_stage stage)
+{
+    return &stages[stage].wake;
+}
+
+void sched_kick(enum sched_stage stage)
+{
+    sched_wake(stage);
+}
+
+/* Snap every hot stage back to its min period, and every other one down to its current max, and
+ * wake it if it is sleeping longer than that. Returns the woken stages.
+ */
+static uint32_t sched_reevaluate(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+    uint32_t periods[SCHED_STAGE_COUNT];
+    uint32_t woken = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(stages); i++)
+    {
+        uint32_t target = sched_stage_hot(i) ? stages[i].min_ms : MIN(stages[i].period_ms, sched_stage_max(i));
+
+        if (stages[i].period_ms > target)
+        {
+            stages[i].period_ms = target;
+            woken |= BIT(i);
+        }
+        periods[i] = stages[i].period_ms;
+    }
+    k_spin_unlock(&sched_lock, key);
+
+    for (size_t i = 0; i < ARRAY_SIZE(stages); i++)
+    {
+        if (woken & BIT(i))
+        {
+            LOG_INF("%s period back to %u ms", stage_str[i], periods[i]);
+            sched_wake(i);
+        }
+    }
+    return woken;
+}
+
+uint32_t sched_period_ms(enum sched_stage stage)
+{
+    return stages[stage].period_ms;
+}
+
+uint32_t sched_advance(enum sched_stage stage)
+{
+    struct sched_stage_state *st = &stages[stage];
+
+    // back off for the next cycle unless something keeps the stage hot
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+    uint32_t prev = st->period_ms;
+
+    st->period_ms = sched_stage_hot(stage) ? st->min_ms : MIN(st->period_ms * 2, sched_stage_max(stage));
+    k_spin_unlock(&sched_lock, key);
+
+    if (st->period_ms != prev)
+    {
+        LOG_DBG("%s period %u -> %u ms", stage_str[stage], prev, st->period_ms);
+    }
+    return st->period_ms;
+}
+
+void sched_sleep(enum sched_stage stage)
+{
+    (void)k_sem_take(&stages[stage].wake, K_MSEC(stages[stage].period_ms));
+    sched_advance(stage);
+}
+
+int sched_set_limits(enum sched_stage stage, uint32_t min_ms, uint32_t max_ms)
+{
+    if (stage >= SCHED_STAGE_COUNT || min_ms < SCHED_PERIOD_FLOOR_MS || min_ms > max_ms)
+    {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+
+    stages[stage].min_ms = min_ms;
+    stages[stage].max_ms = max_ms;
+    stages[stage].period_ms = CLAMP(stages[stage].period_ms, min_ms, max_ms);
+    k_spin_unlock(&sched_lock, key);
+
+    LOG_INF("%s period limits set to %u-%u ms", stage_str[stage], min_ms, max_ms);
+    sched_wake(stage);
+    return 0;
+}
+
+void sched_get_limits(enum sched_stage stage, uint32_t *min_ms, uint32_t *max_ms)
+{
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+
+    *min_ms = stages[stage].min_ms;
+    *max_ms = stages[stage].max_ms;
+    k_spin_unlock(&sched_lock, key);
+}
+
+/* The slope is taken over a fixed window rather than between two reports, so one 0.01 % step
+ * weighs the same at every fuel gauge period. Between window ends the last decision holds, except
+ * that a change already worth the threshold over a whole window counts as moving right away.
+ */
+void sched_report_soc(int32_t soc_centi_pct)
+{
+    const int64_t window_ms = (int64_t)CONFIG_SCHED_SOC_SLOPE_WINDOW_S * MSEC_PER_SEC;
+    int64_t now = k_uptime_get();
+
+    if (anchor_soc < 0)
+    {
+        anchor_soc = soc_centi_pct;
+        anchor_soc_time = now;
+        return;
+    }
+
+    int64_t elapsed = now - anchor_soc_time;
+    int64_t change = abs(soc_centi_pct - anchor_soc);
+    bool moving;
+
+    if (elapsed >= window_ms)
+    {
+        // slope in 0.01 % per minute over the window (or slightly more, the reports are not aligned to it)
+        moving = change * MSEC_PER_SEC * 60 / elapsed >= CONFIG_SCHED_SOC_SLOPE_THRESHOLD;
+        anchor_soc = soc_centi_pct;
+        anchor_soc_time = now;
+    }
+    else if (change * MSEC_PER_SEC * 60 >= (int64_t)CONFIG_SCHED_SOC_SLOPE_THRESHOLD * window_ms)
+    {
+        moving = true;
+        anchor_soc = soc_centi_pct;
+        anchor_soc_time = now;
+    }
+    else
+    {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+    soc_moving = moving;
+    k_spin_unlock(&sched_lock, key);
+
+    if (moving)
+    {
+        sched_reevaluate();
+    }
+}
+
+void sched_set_link(bool connected, bool subscribed)
+{
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+    bool changed = (connected != link_connected) || (subscribed != link_subscribed);
+
+    link_connected = connected;
+    link_subscribed = subscribed;
+    k_spin_unlock(&sched_lock, key);
+
+    if (changed)
+    {
+        LOG_INF("link state: %s, %s", connected ? "connected" : "disconnected",
+                subscribed ? "subscribed" : "not subscribed");
+        sched_reevaluate();
+    }
+}
+
+void sched_note_setpoint_change(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+    last_setpoint_change = k_uptime_get();
+    k_spin_unlock(&sched_lock, key);
+
+    sched_reevaluate();
+}
+
+void sched_note_pmic_event(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+    last_pmic_event = k_uptime_get();
+    k_spin_unlock(&sched_lock, key);
+
+    // even at its min period the fuel gauge should not wait for its next cycle
+    if (!(sched_reevaluate() & BIT(SCHED_STAGE_FG)))
+    {
+        sched_wake(SCHED_STAGE_FG);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum sched_stage
+{
+    SCHED_STAGE_FG,     // fuel gauge update (I2C + nrf_fuel_gauge_process)
+    SCHED_STAGE_ADC,    // one ADC block
+    SCHED_STAGE_NOTIFY, // BLE publisher tick
+    SCHED_STAGE_COUNT,
+};
+
+// current period of a stage in ms
+uint32_t sched_period_ms(enum sched_stage stage);
+
+// close one cycle of a stage and return the period of the next one, for stages that time themselves
+uint32_t sched_advance(enum sched_stage stage);
+
+// sleep for the current period of a stage then advance it, returns early if the policy asks for a faster period
+void sched_sleep(enum sched_stage stage);
+
+// change the fastest/slowest period of a stage at runtime, -EINVAL if out of range
+int sched_set_limits(enum sched_stage stage, uint32_t min_ms, uint32_t max_ms);
+void sched_get_limits(enum sched_stage stage, uint32_t *min_ms, uint32_t *max_ms);
+
+// called when a stage is woken early (became hot or its limits changed), for callers that do not sleep in sched_sleep()
+typedef void (*sched_wake_cb_t)(enum sched_stage stage);
+void sched_set_wake_cb(sched_wake_cb_t cb);
+
+// the semaphore sched_sleep() waits on, for callers that also wait on something else (k_poll)
+struct k_sem *sched_wake_sem(enum sched_stage stage);
+
+// run a stage now without changing its period, e.g. the publisher once fresh values are in
+void sched_kick(enum sched_stage stage);
+
+// policy inputs
+void sched_report_soc(int32_t soc_centi_pct);
+void sched_set_link(bool connected, bool subscribed);
+void sched_note_setpoint_change(void);
+void sched_note_pmic_event(void); // also wakes the fuel gauge right away
+
+#endif
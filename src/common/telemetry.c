@@ -0,0 +1,92 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * telemetry.c
+ * latest-value snapshot shared between the producer modules and the BLE publisher.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/barrier.h>
+
+#include "telemetry.h"
+
+/* Seqlock: writers serialize on a spinlock and bump the sequence to odd while they update,
+ * readers copy without locking and retry if the sequence was odd or moved during the copy.
+ */
+static struct telemetry_snapshot snapshot;
+static atomic_t snapshot_seq;
+static struct k_spinlock writer_lock;
+
+static k_spinlock_key_t telemetry_write_begin(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&writer_lock);
+
+    atomic_inc(&snapshot_seq);
+    barrier_dmem_fence_full();
+    return key;
+}
+
+static void telemetry_write_end(k_spinlock_key_t key)
+{
+    barrier_dmem_fence_full();
+    atomic_inc(&snapshot_seq);
+    k_spin_unlock(&writer_lock, key);
+}
+
+void telemetry_publish_adc(const struct adc_sample_msg *msg)
+{
+    k_spinlock_key_t key = telemetry_write_begin();
+
+    snapshot.adc = *msg;
+    snapshot.adc_gen++;
+    telemetry_write_end(key);
+}
+
+void telemetry_publish_pmic(const struct pmic_report_msg *msg)
+{
+    k_spinlock_key_t key = telemetry_write_begin();
+
+    snapshot.pmic = *msg;
+    snapshot.pmic_gen++;
+    telemetry_write_end(key);
+}
+
+void telemetry_publish_lsldo_setpoint(int32_t setpoint_mv)
+{
+    k_spinlock_key_t key = telemetry_write_begin();
+
+    snapshot.lsldo_setpoint_mv = setpoint_mv;
+    snapshot.lsldo_setpoint_timestamp = k_uptime_get_32();
+    snapshot.lsldo_gen++;
+    telemetry_write_end(key);
+}
+
+void telemetry_publish_pmic_events(uint32_t events)
+{
+    k_spinlock_key_t key = telemetry_write_begin();
+
+    snapshot.pmic_events = events;
+    snapshot.pmic_events_timestamp = k_uptime_get_32();
+    snapshot.pmic_events_gen++;
+    telemetry_write_end(key);
+}
+
+void telemetry_read(struct telemetry_snapshot *snap)
+{
+    atomic_val_t seq;
+
+    do
+    {
+        seq = atomic_get(&snapshot_seq);
+        if (seq & 1)
+        {
+            continue; // writer active on another core
+        }
+        barrier_dmem_fence_full();
+        memcpy(snap, &snapshot, sizeof(*snap));
+        barrier_dmem_fence_full();
+    } while ((seq & 1) || atomic_get(&snapshot_seq) != seq);
+}
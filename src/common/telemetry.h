@@ -0,0 +1,35 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+#include "npm_adc.h"
+#include "pmic.h"
+
+/* Latest value published by each producer module. The *_gen counters increment on every publish,
+ * a reader compares them with the previous snapshot to find out what changed. 0 means never published.
+ */
+struct telemetry_snapshot
+{
+    struct adc_sample_msg adc;
+    uint32_t adc_gen;
+    struct pmic_report_msg pmic;
+    uint32_t pmic_gen;
+    int32_t lsldo_setpoint_mv;
+    uint32_t lsldo_setpoint_timestamp;
+    uint32_t lsldo_gen;
+    uint32_t pmic_events;           // enum pmic_event bits of the last nPM2100 interrupt
+    uint32_t pmic_events_timestamp; // k_uptime_get_32() when it was handled
+    uint32_t pmic_events_gen;
+};
+
+// producers, never block
+void telemetry_publish_adc(const struct adc_sample_msg *msg);
+void telemetry_publish_pmic(const struct pmic_report_msg *msg);
+void telemetry_publish_lsldo_setpoint(int32_t setpoint_mv);
+void telemetry_publish_pmic_events(uint32_t events);
+
+// copy one consistent snapshot of all sections, never blocks on a producer
+void telemetry_read(struct telemetry_snapshot *snap);
+
+#endif
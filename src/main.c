@@ -13,6 +13,7 @@
 
 #include <zephyr/logging/log.h>
 
+#include "pipeline.h"
 #include "threads.h"
 #include "tsync.h"
 
@@ -33,9 +34,22 @@ int main(void)
         return -1;
     }
 
-    k_sem_take(&sem_pmic_ready, K_FOREVER);
-    k_sem_give(&sem_gpio_ready);
-    k_sem_take(&sem_ble_ready, K_FOREVER);
+    if (IS_ENABLED(CONFIG_PIPELINE))
+    {
+        // no module threads, bring everything up in order and hand over to the pipeline queue
+        err = pipeline_start();
+        if (err)
+        {
+            LOG_ERR("Pipeline start failed (err %d)", err);
+            return -1;
+        }
+    }
+    else
+    {
+        k_sem_take(&sem_pmic_ready, K_FOREVER);
+        k_sem_give(&sem_gpio_ready);
+        k_sem_take(&sem_ble_ready, K_FOREVER);
+    }
 
     for (;;)
     {
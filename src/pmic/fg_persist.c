@@ -0,0 +1,143 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * fg_persist.c
+ * wear-aware checkpointing of the fuel gauge state through the settings subsystem.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include <nrf_fuel_gauge.h>
+
+#include "fg_persist.h"
+
+LOG_MODULE_REGISTER(fg_persist, LOG_LEVEL_INF);
+
+#define FG_PERSIST_STATE_MAX_SIZE 512
+
+static uint8_t fg_state[FG_PERSIST_STATE_MAX_SIZE];
+static bool fg_state_loaded;
+static uint8_t saved_battery = UINT8_MAX;
+static bool restored; // ignore later settings_load() calls from other modules
+
+static int32_t last_checkpoint_soc = -1;
+// seeded so the first checkpoint is due CONFIG_FG_CHECKPOINT_FIRST_S after boot, not a whole interval
+static int64_t last_checkpoint =
+    ((int64_t)CONFIG_FG_CHECKPOINT_FIRST_S - CONFIG_FG_CHECKPOINT_INTERVAL_S) * MSEC_PER_SEC;
+static uint32_t checkpoint_count;
+
+static int fg_persist_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    ssize_t rc;
+
+    if (restored)
+    {
+        return 0;
+    }
+
+    if (!strcmp(name, "state"))
+    {
+        if (len != nrf_fuel_gauge_state_size || len > sizeof(fg_state))
+        {
+            LOG_WRN("Stored fuel gauge state has an unexpected size (%d), ignoring it", (int)len);
+            return 0;
+        }
+        rc = read_cb(cb_arg, fg_state, len);
+        fg_state_loaded = (rc == len);
+        return rc < 0 ? rc : 0;
+    }
+    if (!strcmp(name, "battery"))
+    {
+        rc = read_cb(cb_arg, &saved_battery, sizeof(saved_battery));
+        return rc < 0 ? rc : 0;
+    }
+
+    return -ENOENT;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(fg, "fg", NULL, fg_persist_set, NULL, NULL);
+
+const void *fg_persist_restore(enum battery_type battery)
+{
+    int err;
+
+    if (nrf_fuel_gauge_state_size > sizeof(fg_state))
+    {
+        LOG_ERR("Fuel gauge state (%d bytes) does not fit the checkpoint buffer", (int)nrf_fuel_gauge_state_size);
+        return NULL;
+    }
+
+    err = settings_subsys_init();
+    if (!err)
+    {
+        err = settings_load_subtree("fg");
+    }
+    restored = true;
+    if (err)
+    {
+        LOG_ERR("Could not load fuel gauge checkpoint (err %d)", err);
+        return NULL;
+    }
+
+    if (!fg_state_loaded)
+    {
+        LOG_INF("No fuel gauge checkpoint stored, starting from scratch");
+        return NULL;
+    }
+    if (saved_battery != battery)
+    {
+        LOG_WRN("Fuel gauge checkpoint was taken with another battery model, discarding it");
+        return NULL;
+    }
+
+    LOG_INF("Restoring fuel gauge checkpoint");
+    return fg_state;
+}
+
+void fg_persist_checkpoint(enum battery_type battery, float soc)
+{
+    int32_t soc_centi = (int32_t)(soc * 100);
+    int64_t now = k_uptime_get();
+    int err;
+
+    // rate limit writes, and skip them entirely while the SoC sits still
+    if ((now - last_checkpoint) < (int64_t)CONFIG_FG_CHECKPOINT_INTERVAL_S * MSEC_PER_SEC)
+    {
+        return;
+    }
+    if (last_checkpoint_soc >= 0 && abs(soc_centi - last_checkpoint_soc) < CONFIG_FG_CHECKPOINT_SOC_DELTA)
+    {
+        return;
+    }
+
+    err = nrf_fuel_gauge_state_get(fg_state, nrf_fuel_gauge_state_size);
+    if (err)
+    {
+        LOG_ERR("Could not get fuel gauge state (err %d)", err);
+        return;
+    }
+
+    err = settings_save_one("fg/state", fg_state, nrf_fuel_gauge_state_size);
+    if (!err && saved_battery != battery)
+    {
+        // only rewritten when the model changes
+        saved_battery = battery;
+        err = settings_save_one("fg/battery", &saved_battery, sizeof(saved_battery));
+    }
+    if (err)
+    {
+        LOG_ERR("Could not save fuel gauge checkpoint (err %d)", err);
+        return;
+    }
+
+    last_checkpoint = now;
+    last_checkpoint_soc = soc_centi;
+    checkpoint_count++;
+    LOG_INF("Fuel gauge checkpoint #%u saved at SoC %d.%02d%%", checkpoint_count, soc_centi / 100, soc_centi % 100);
+}
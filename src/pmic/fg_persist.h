@@ -0,0 +1,18 @@
+#ifndef FG_PERSIST_H_
+#define FG_PERSIST_H_
+
+#include <stdint.h>
+
+#include "pmic.h"
+
+/* Load the checkpoint from the settings backend.
+ * Returns the saved nRF Fuel Gauge state if it was taken with the same battery model, NULL otherwise.
+ * No elapsed-time reference is stored, the first update after a restore measures its delta from
+ * the ref_time taken when the fuel gauge is initialised at boot.
+ */
+const void *fg_persist_restore(enum battery_type battery);
+
+// save the fuel gauge state if enough time has passed and the SoC moved enough since the last checkpoint
+void fg_persist_checkpoint(enum battery_type battery, float soc);
+
+#endif
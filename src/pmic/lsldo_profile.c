@@ -0,0 +1,339 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * lsldo_profile.c
+ * timed LS/LDO setpoint profiles (steps, ramps) with an ADC measured settling benchmark.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include "lsldo_profile.h"
+#include "npm_adc.h"
+#include "pmic.h"
+
+LOG_MODULE_REGISTER(lsldo_profile, LOG_LEVEL_INF);
+
+#define LSLDO_PROFILE_MIN_MV 800
+#define LSLDO_PROFILE_MAX_MV 3000
+#define LSLDO_PROFILE_LEAD_US 10000 // first deadline, leaves time to get scheduled
+// the block sampler hands the SAADC over at the end of its block, which can take a full ADC period
+#define LSLDO_PROFILE_ACQUIRE_TIMEOUT K_SECONDS(120)
+
+static struct lsldo_segment profile[CONFIG_LSLDO_PROFILE_MAX_SEGMENTS];
+static size_t profile_len;
+static atomic_t profile_running;
+static K_SEM_DEFINE(profile_start, 0, 1);
+
+static struct lsldo_step_result results[CONFIG_LSLDO_PROFILE_MAX_SEGMENTS];
+static size_t results_len;
+static K_MUTEX_DEFINE(results_lock);
+
+static int16_t capture[CONFIG_LSLDO_PROFILE_CAPTURE_SAMPLES];
+
+static int64_t profile_now_us(void)
+{
+    return k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+// apply one setpoint at an absolute deadline, keeps the worst lateness in res
+static int profile_set(int64_t deadline_us, int32_t mv, struct lsldo_step_result *res)
+{
+    k_sleep(K_TIMEOUT_ABS_US(deadline_us));
+
+    int32_t late_us = (int32_t)(profile_now_us() - deadline_us);
+    uint32_t start = k_cycle_get_32();
+    int err = pmic_lsldo_set(mv);
+
+    res->apply_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    res->late_us = MAX(res->late_us, late_us);
+    return err;
+}
+
+/* Reduce a capture taken right after the setpoint write. The final value is the mean of the
+ * last eighth of the capture, the rail has settled once it stays within the band around it.
+ */
+static void profile_analyze(const int16_t *mv, size_t count, uint32_t sample_ns, struct lsldo_step_result *res)
+{
+    size_t tail = MAX(count / 8, 1);
+    bool rising = res->to_mv >= res->from_mv;
+    int32_t sum = 0;
+    int32_t peak = 0;
+    size_t last_out = 0;
+    bool out = false;
+
+    for (size_t i = count - tail; i < count; i++)
+    {
+        sum += mv[i];
+    }
+    int32_t final_mv = sum / (int32_t)tail;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        int32_t delta = mv[i] - final_mv;
+
+        peak = MAX(peak, rising ? delta : -delta);
+        if (abs(delta) > CONFIG_LSLDO_PROFILE_SETTLE_BAND_MV)
+        {
+            last_out = i;
+            out = true;
+        }
+    }
+
+    res->final_mv = final_mv;
+    res->error_mv = final_mv - res->to_mv;
+    res->overshoot_mv = peak;
+    if (!out)
+    {
+        res->settle_us = 0; // settled before the first sample
+    }
+    else if (last_out >= count - tail)
+    {
+        res->settle_us = -1; // still moving at the end of the capture
+    }
+    else
+    {
+        res->settle_us = (int32_t)(((uint64_t)(last_out + 1) * sample_ns) / NSEC_PER_USEC);
+    }
+}
+
+// capture the rail after the last write of a segment and store the result
+static void profile_measure(size_t idx, struct lsldo_step_result *res)
+{
+    uint32_t start = k_cycle_get_32();
+    int err = npm_adc_capture(NPM_ADC_CH_LSLDO, capture, ARRAY_SIZE(capture),
+                              CONFIG_LSLDO_PROFILE_CAPTURE_INTERVAL_US);
+    uint32_t capture_ns = k_cyc_to_ns_floor32(k_cycle_get_32() - start);
+
+    if (err)
+    {
+        res->settle_us = -1;
+    }
+    else
+    {
+        // measured rather than configured, back to back sampling has no nominal interval
+        profile_analyze(capture, ARRAY_SIZE(capture), capture_ns / ARRAY_SIZE(capture), res);
+    }
+
+    LOG_INF("%s %u -> %u mV: late %d us, write %u us, settled %d us, overshoot %u mV, final %d mV (error %d mV)",
+            (profile[idx].kind == LSLDO_SEGMENT_RAMP) ? "ramp" : "step", res->from_mv, res->to_mv, res->late_us,
+            res->apply_us, res->settle_us, res->overshoot_mv, res->final_mv, res->error_mv);
+
+    k_mutex_lock(&results_lock, K_FOREVER);
+    results[idx] = *res;
+    results_len = idx + 1;
+    k_mutex_unlock(&results_lock);
+}
+
+static void profile_run(void)
+{
+    int32_t cur_mv;
+    int err;
+
+    err = npm_adc_acquire(LSLDO_PROFILE_ACQUIRE_TIMEOUT);
+    if (err)
+    {
+        LOG_ERR("ADC not available for the profile (%d)", err);
+        return;
+    }
+    if (pmic_lsldo_get(&cur_mv))
+    {
+        npm_adc_release();
+        return;
+    }
+
+    k_mutex_lock(&results_lock, K_FOREVER);
+    results_len = 0;
+    k_mutex_unlock(&results_lock);
+
+    LOG_INF("Profile of %d segments starting at %d mV", (int)profile_len, cur_mv);
+    int64_t deadline_us = profile_now_us() + LSLDO_PROFILE_LEAD_US;
+
+    for (size_t i = 0; i < profile_len && !err; i++)
+    {
+        const struct lsldo_segment *seg = &profile[i];
+        struct lsldo_step_result res = {.from_mv = cur_mv, .to_mv = seg->mv, .late_us = INT32_MIN};
+        int32_t delta_mv = seg->mv - cur_mv;
+
+        if (seg->kind == LSLDO_SEGMENT_RAMP)
+        {
+            // evenly spaced writes, the target is reached one sub-step before the end of the segment
+            int32_t steps = MAX(abs(delta_mv) / CONFIG_LSLDO_PROFILE_RAMP_STEP_MV, 1);
+
+            for (int32_t k = 0; k < steps && !err; k++)
+            {
+                int64_t at_us = deadline_us + (int64_t)seg->duration_ms * USEC_PER_MSEC * k / steps;
+                err = profile_set(at_us, cur_mv + delta_mv * (k + 1) / steps, &res);
+            }
+        }
+        else
+        {
+            err = profile_set(deadline_us, seg->mv, &res);
+        }
+
+        if (!err)
+        {
+            profile_measure(i, &res);
+        }
+        cur_mv = seg->mv;
+        deadline_us += (int64_t)seg->duration_ms * USEC_PER_MSEC;
+    }
+
+    npm_adc_release();
+    LOG_INF("Profile %s", err ? "aborted" : "done");
+}
+
+int lsldo_profile_decode(const uint8_t *buf, size_t len, struct lsldo_segment *segs, size_t max)
+{
+    if (len < 1 + LSLDO_PROFILE_WR_SEGMENT_LEN || buf[0] != LSLDO_PROFILE_WR_TAG ||
+        (len - 1) % LSLDO_PROFILE_WR_SEGMENT_LEN)
+    {
+        return -EINVAL;
+    }
+
+    size_t count = (len - 1) / LSLDO_PROFILE_WR_SEGMENT_LEN;
+    if (count > max)
+    {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *entry = &buf[1 + i * LSLDO_PROFILE_WR_SEGMENT_LEN];
+
+        segs[i].kind = entry[0];
+        segs[i].mv = sys_get_le16(&entry[1]);
+        segs[i].duration_ms = sys_get_le16(&entry[3]);
+    }
+    return count;
+}
+
+int lsldo_profile_submit(const struct lsldo_segment *segs, size_t count)
+{
+    if (count == 0 || count > ARRAY_SIZE(profile))
+    {
+        return -EINVAL;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (segs[i].kind > LSLDO_SEGMENT_RAMP || segs[i].mv < LSLDO_PROFILE_MIN_MV ||
+            segs[i].mv > LSLDO_PROFILE_MAX_MV)
+        {
+            LOG_ERR("segment %d rejected (kind %u, %u mV)", (int)i, segs[i].kind, segs[i].mv);
+            return -EINVAL;
+        }
+    }
+    if (!atomic_cas(&profile_running, 0, 1))
+    {
+        return -EBUSY;
+    }
+
+    memcpy(profile, segs, count * sizeof(segs[0]));
+    profile_len = count;
+    k_sem_give(&profile_start);
+    return 0;
+}
+
+size_t lsldo_profile_results(struct lsldo_step_result *out, size_t max)
+{
+    k_mutex_lock(&results_lock, K_FOREVER);
+    size_t n = MIN(max, results_len);
+
+    memcpy(out, results, n * sizeof(results[0]));
+    k_mutex_unlock(&results_lock);
+    return n;
+}
+
+void lsldo_profile_thread(void)
+{
+    for (;;)
+    {
+        k_sem_take(&profile_start, K_FOREVER);
+        profile_run();
+        atomic_set(&profile_running, 0);
+    }
+}
+
+K_THREAD_DEFINE(lsldo_profile_thread_id, CONFIG_LSLDO_PROFILE_STACK_SIZE, lsldo_profile_thread, NULL, NULL, NULL,
+                CONFIG_LSLDO_PROFILE_PRIORITY, 0, 0);
+
+#if defined(CONFIG_SHELL)
+
+// lsldo_profile run s 1800 200 r 3000 500 s 1200 200
+static int cmd_profile_run(const struct shell *sh, size_t argc, char **argv)
+{
+    struct lsldo_segment segs[CONFIG_LSLDO_PROFILE_MAX_SEGMENTS];
+    size_t count = 0;
+
+    if ((argc - 1) % 3 != 0 || (argc - 1) / 3 > ARRAY_SIZE(segs))
+    {
+        shell_error(sh, "expected up to %d segments of <s|r> <mV> <ms>", CONFIG_LSLDO_PROFILE_MAX_SEGMENTS);
+        return -EINVAL;
+    }
+    for (size_t i = 1; i < argc; i += 3, count++)
+    {
+        char *mv_end;
+        char *ms_end;
+        unsigned long mv = strtoul(argv[i + 1], &mv_end, 10);
+        unsigned long ms = strtoul(argv[i + 2], &ms_end, 10);
+
+        if (strcmp(argv[i], "s") != 0 && strcmp(argv[i], "r") != 0)
+        {
+            shell_error(sh, "unknown segment kind '%s', expected s or r", argv[i]);
+            return -EINVAL;
+        }
+        // checked before narrowing, so a large value cannot wrap into the range
+        if (mv_end == argv[i + 1] || *mv_end != '\0' || mv < LSLDO_PROFILE_MIN_MV || mv > LSLDO_PROFILE_MAX_MV)
+        {
+            shell_error(sh, "'%s' is not a setpoint in %d-%d mV", argv[i + 1], LSLDO_PROFILE_MIN_MV,
+                        LSLDO_PROFILE_MAX_MV);
+            return -EINVAL;
+        }
+        if (ms_end == argv[i + 2] || *ms_end != '\0' || ms > UINT16_MAX)
+        {
+            shell_error(sh, "'%s' is not a duration in 0-%d ms", argv[i + 2], UINT16_MAX);
+            return -EINVAL;
+        }
+        segs[count].kind = (argv[i][0] == 'r') ? LSLDO_SEGMENT_RAMP : LSLDO_SEGMENT_STEP;
+        segs[count].mv = (uint16_t)mv;
+        segs[count].duration_ms = (uint16_t)ms;
+    }
+
+    int err = lsldo_profile_submit(segs, count);
+    if (err)
+    {
+        shell_error(sh, "profile rejected (%d)", err);
+    }
+    return err;
+}
+
+static int cmd_profile_results(const struct shell *sh, size_t argc, char **argv)
+{
+    struct lsldo_step_result res[CONFIG_LSLDO_PROFILE_MAX_SEGMENTS];
+    size_t n = lsldo_profile_results(res, ARRAY_SIZE(res));
+
+    shell_print(sh, "%6s %6s %8s %8s %9s %7s %6s %6s", "from", "to", "late us", "write us", "settle us", "over mV",
+                "final", "error");
+    for (size_t i = 0; i < n; i++)
+    {
+        shell_print(sh, "%6u %6u %8d %8u %9d %7u %6d %6d", res[i].from_mv, res[i].to_mv, res[i].late_us,
+                    res[i].apply_us, res[i].settle_us, res[i].overshoot_mv, res[i].final_mv, res[i].error_mv);
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_lsldo_profile,
+                               SHELL_CMD_ARG(run, NULL, "<s|r> <mV> <ms> ...: steps and ramps", cmd_profile_run, 4,
+                                             3 * (CONFIG_LSLDO_PROFILE_MAX_SEGMENTS - 1)),
+                               SHELL_CMD(results, NULL, "Settling results of the last profile", cmd_profile_results),
+                               SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(lsldo_profile, &sub_lsldo_profile, "LS/LDO setpoint profiles", NULL);
+
+#endif
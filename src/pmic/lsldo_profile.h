@@ -0,0 +1,53 @@
+#ifndef LSLDO_PROFILE_H_
+#define LSLDO_PROFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Timed LS/LDO setpoint sequences with a settling benchmark. After every step (and at the end of
+ * every ramp) the LS/LDO rail is captured at a high rate and the response is reduced to settling
+ * time, overshoot and final error.
+ */
+
+enum lsldo_segment_kind
+{
+    LSLDO_SEGMENT_STEP, // jump to mv, then hold for duration_ms
+    LSLDO_SEGMENT_RAMP, // move linearly from the previous setpoint to mv over duration_ms
+};
+
+struct lsldo_segment
+{
+    uint8_t kind; // enum lsldo_segment_kind
+    uint16_t mv;
+    uint16_t duration_ms;
+};
+
+struct lsldo_step_result
+{
+    uint16_t from_mv;
+    uint16_t to_mv;
+    int32_t late_us;       // setpoint write started this long after its deadline
+    uint32_t apply_us;     // regulator_set_voltage() duration (I2C)
+    int32_t settle_us;     // from the end of the write until the rail stays in the band, -1 if it never did
+    uint16_t overshoot_mv; // past the final value, in the direction of the step
+    int16_t final_mv;      // mean of the capture tail
+    int16_t error_mv;      // final_mv - to_mv
+};
+
+/* BLE write format on the LS/LDO Write characteristic: LSLDO_PROFILE_WR_TAG followed by
+ * LSLDO_PROFILE_WR_SEGMENT_LEN bytes per segment: [kind][mv u16 LE][duration_ms u16 LE].
+ * The tag is not a valid BCD digit pair, so it cannot be confused with a single setpoint.
+ */
+#define LSLDO_PROFILE_WR_TAG 0xF0
+#define LSLDO_PROFILE_WR_SEGMENT_LEN 5
+
+// parse a BLE profile write (tag included), returns the number of segments or -EINVAL
+int lsldo_profile_decode(const uint8_t *buf, size_t len, struct lsldo_segment *segs, size_t max);
+
+// start a profile in the background, -EBUSY while one is running, -EINVAL on out of range segments
+int lsldo_profile_submit(const struct lsldo_segment *segs, size_t count);
+
+// results of the last profile, one per step and one per ramp, returns the number copied
+size_t lsldo_profile_results(struct lsldo_step_result *results, size_t max);
+
+#endif
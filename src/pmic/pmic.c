@@ -6,6 +6,7 @@
  * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <zephyr/device.h>
 #include <zephyr/kernel.h>
@@ -17,19 +18,27 @@
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/drivers/sensor/npm2100_vbat.h>
 #include <zephyr/dt-bindings/regulator/npm2100.h>
+#include <zephyr/rtio/rtio.h>
 #include <zephyr/sys/util.h>
 
+#include "bench.h"
+#include "counters.h"
+#include "energy.h"
+#include "fg_persist.h"
+#include "fixed_point.h"
 #include "pmic.h"
+#include "pmic_events.h"
+#include "rtpm.h"
+#include "sched.h"
+#include "telemetry.h"
 
 #include <nrf_fuel_gauge.h>
 
 #define PMIC_THREAD_STACK_SIZE 1024
 #define PMIC_THREAD_PRIORITY 5
-#define PMIC_SLEEP_INTERVAL_MS 1000
 
 LOG_MODULE_REGISTER(pmic, LOG_LEVEL_INF);
 
-K_MSGQ_DEFINE(pmic_msgq, sizeof(struct pmic_report_msg), 8, 4);
 K_SEM_DEFINE(sem_pmic_ready, 0, 1);
 
 static const struct device *npm2100_lsldo_regulator = DEVICE_DT_GET(DT_NODELABEL(npm2100ek_ldosw));
@@ -37,6 +46,16 @@ static const struct device *vbat = DEVICE_DT_GET(DT_NODELABEL(npm2100ek_vbat));
 
 static enum battery_type battery_model;
 static bool fuel_gauge_initialized;
+// the fuel gauge library and the vbat RTIO context, shared by the FG step and the benchmarks
+static K_MUTEX_DEFINE(fg_lock);
+
+/* vbat and die temperature are read through the async sensor API, the I2C transfer runs on
+ * the RTIO executor while the caller does other work (the ADC block in pipeline mode) or sleeps.
+ */
+SENSOR_DT_READ_IODEV(vbat_iodev, DT_NODELABEL(npm2100ek_vbat), {SENSOR_CHAN_GAUGE_VOLTAGE, 0},
+                     {SENSOR_CHAN_DIE_TEMP, 0});
+RTIO_DEFINE_WITH_MEMPOOL(vbat_rtio, 1, 1, 2, 64, 4);
+static bool vbat_read_pending;
 
 static const char *const battery_model_str[] = {
     [BATTERY_TYPE_ALKALINE_AA] = "Alkaline AA",     [BATTERY_TYPE_ALKALINE_AAA] = "Alkaline AAA",
@@ -72,35 +91,96 @@ static const struct battery_model_primary battery_models[] = {
         },
 };
 
-/* Basic assumption of average battery current.
- * Using a non-zero value improves the fuel gauge accuracy, even if the number is not exact.
+static enum battery_type selected_battery_model;
+
+/* start the vbat/temperature read, read_sensors() picks up the result. The TWI is resumed here
+ * and suspended again once the result is consumed.
  */
-static const float battery_current[] = {
-    [BATTERY_TYPE_ALKALINE_AA] = 5e-3f,     [BATTERY_TYPE_ALKALINE_AAA] = 5e-3f,
-    [BATTERY_TYPE_ALKALINE_2SAA] = 5e-3f,   [BATTERY_TYPE_ALKALINE_2SAAA] = 5e-3f,
-    [BATTERY_TYPE_ALKALINE_LR44] = 1.5e-3f, [BATTERY_TYPE_LITHIUM_CR2032] = 1.5e-3f,
-};
+int pmic_fg_prefetch(void)
+{
+    int ret = 0;
 
-static enum battery_type selected_battery_model;
+    k_mutex_lock(&fg_lock, K_FOREVER);
+    if (!vbat_read_pending)
+    {
+        ret = rtpm_get(RTPM_TWI);
+        if (ret == 0)
+        {
+            ret = sensor_read_async_mempool(&vbat_iodev, &vbat_rtio, NULL);
+            if (ret < 0)
+            {
+                LOG_ERR("sensor_read_async_mempool() returned %d", ret);
+                rtpm_put(RTPM_TWI);
+            }
+            else
+            {
+                // only a submitted transfer is charged by the energy estimate
+                counter_inc(COUNTER_PMIC_FETCH);
+                vbat_read_pending = true;
+            }
+        }
+    }
+    k_mutex_unlock(&fg_lock);
+    return ret;
+}
 
-static int read_sensors(const struct device *vbat, float *voltage, float *temp)
+static int decode_channel(const struct sensor_decoder_api *decoder, const uint8_t *buf, enum sensor_channel chan,
+                          struct sensor_q31_data *data)
 {
-    struct sensor_value value;
+    uint32_t fit = 0;
+    int ret = decoder->decode(buf, (struct sensor_chan_spec){chan, 0}, &fit, 1, data);
+
+    return (ret == 1) ? 0 : -ENODATA;
+}
+
+// battery voltage in mV and die temperature in 0.01 deg C
+static int read_sensors(const struct device *vbat, int32_t *voltage_mv, int32_t *temp)
+{
+    const struct sensor_decoder_api *decoder;
+    struct sensor_q31_data data = {0};
+    struct rtio_cqe *cqe;
+    uint8_t *buf;
+    uint32_t buf_len;
     int ret;
 
-    ret = sensor_sample_fetch(vbat);
+    ret = pmic_fg_prefetch();
     if (ret < 0)
     {
         return ret;
     }
 
-    sensor_channel_get(vbat, SENSOR_CHAN_GAUGE_VOLTAGE, &value);
-    *voltage = (float)value.val1 + ((float)value.val2 / 1000000);
+    // sleeps until the transfer completed, a prefetch usually finished already
+    cqe = rtio_cqe_consume_block(&vbat_rtio);
+    vbat_read_pending = false;
+    rtpm_put(RTPM_TWI);
+    ret = cqe->result;
+    if (ret >= 0)
+    {
+        ret = rtio_cqe_get_mempool_buffer(&vbat_rtio, cqe, &buf, &buf_len);
+    }
+    rtio_cqe_release(&vbat_rtio, cqe);
+    if (ret < 0)
+    {
+        return ret;
+    }
 
-    sensor_channel_get(vbat, SENSOR_CHAN_DIE_TEMP, &value);
-    *temp = (float)value.val1 + ((float)value.val2 / 1000000);
+    ret = sensor_get_decoder(vbat, &decoder);
+    if (ret == 0)
+    {
+        ret = decode_channel(decoder, buf, SENSOR_CHAN_GAUGE_VOLTAGE, &data);
+    }
+    if (ret == 0)
+    {
+        *voltage_mv = q31_to_scaled_i32(data.readings[0].value, data.shift, 1000);
+        ret = decode_channel(decoder, buf, SENSOR_CHAN_DIE_TEMP, &data);
+    }
+    if (ret == 0)
+    {
+        *temp = q31_to_scaled_i32(data.readings[0].value, data.shift, 100);
+    }
+    rtio_release_buffer(&vbat_rtio, buf, buf_len);
 
-    return 0;
+    return ret;
 }
 
 int fuel_gauge_init(const struct device *vbat, enum battery_type battery)
@@ -109,16 +189,28 @@ int fuel_gauge_init(const struct device *vbat, enum battery_type battery)
         .model_primary = &battery_models[battery],
         .i0 = 0.0f,
         .opt_params = NULL,
+        .state = NULL,
     };
+    int32_t voltage_mv;
+    int32_t temp;
     int ret;
 
     LOG_INF("nRF Fuel Gauge version: %s\n", nrf_fuel_gauge_version);
 
-    ret = read_sensors(vbat, &parameters.v0, &parameters.t0);
+    ret = read_sensors(vbat, &voltage_mv, &temp);
     if (ret < 0)
     {
         return ret;
     }
+    // the fuel gauge library works in single precision float
+    parameters.v0 = (float)voltage_mv / 1000.f;
+    parameters.t0 = (float)temp / 100.f;
+
+    if (IS_ENABLED(CONFIG_FG_PERSIST))
+    {
+        // resume from the last checkpoint so SoC does not have to re-converge after a reset
+        parameters.state = fg_persist_restore(battery);
+    }
 
     ret = nrf_fuel_gauge_init(&parameters, NULL);
     if (ret < 0)
@@ -134,34 +226,66 @@ int fuel_gauge_init(const struct device *vbat, enum battery_type battery)
 
 int fuel_gauge_update(const struct device *vbat)
 {
+    int32_t voltage_mv;
+    int32_t temp_centi;
     float voltage;
     float temp;
     float soc;
     float delta;
+    float current;
     int ret;
     struct pmic_report_msg pmic_ble_report;
+    struct telemetry_snapshot snap;
+    // claimed before the read, an event arriving during it wakes the next step
+    uint32_t events = IS_ENABLED(CONFIG_PMIC_EVENTS) ? pmic_events_claim() : 0;
 
-    ret = read_sensors(vbat, &voltage, &temp);
+    ret = read_sensors(vbat, &voltage_mv, &temp_centi);
     if (ret < 0)
     {
         LOG_INF("Error: Could not read from vbat device\n");
+        if (events)
+        {
+            // nothing was reported, the next step that reads the values serves them
+            pmic_events_unclaim(events);
+        }
         return ret;
     }
+    voltage = (float)voltage_mv / 1000.f;
+    temp = (float)temp_centi / 100.f;
 
     delta = (float)k_uptime_delta(&ref_time) / 1000.f;
 
-    soc = nrf_fuel_gauge_process(voltage, battery_current[selected_battery_model], temp, delta, NULL);
-
-    LOG_INF("PMIC Thread sending: V: %.3f, T: %.2f, SoC: %.2f", (double)voltage, (double)temp, (double)soc);
-    pmic_ble_report.batt_voltage = voltage;
-    pmic_ble_report.temp = temp;
-    pmic_ble_report.batt_soc = soc;
-    k_msgq_put(&pmic_msgq, &pmic_ble_report, K_FOREVER);
+    /* Average battery current estimated from radio, CPU, ADC/I2C activity and the LSLDO load.
+     * Using a non-zero value improves the fuel gauge accuracy, even if the number is not exact.
+     */
+    telemetry_read(&snap);
+    current = energy_average_current(voltage, snap.adc.channel_mv[0], snap.adc.channel_mv[1]);
+
+    soc = nrf_fuel_gauge_process(voltage, current, temp, delta, NULL);
+
+    pmic_ble_report.timestamp = k_uptime_get_32();
+    pmic_ble_report.vbat_mv = (uint16_t)voltage_mv;
+    pmic_ble_report.temp = (int16_t)temp_centi;
+    pmic_ble_report.soc = (uint16_t)CLAMP((int32_t)(soc * 100.f), 0, 10000);
+    LOG_INF("PMIC Thread publishing: V: " MILLI_FMT ", T: " CENTI_FMT ", SoC: " CENTI_FMT,
+            MILLI_ARGS(pmic_ble_report.vbat_mv), CENTI_ARGS(pmic_ble_report.temp), CENTI_ARGS(pmic_ble_report.soc));
+    telemetry_publish_pmic(&pmic_ble_report);
+    if (events)
+    {
+        // the publisher should not wait for its next tick to report what the event was about
+        sched_kick(SCHED_STAGE_NOTIFY);
+    }
+    if (IS_ENABLED(CONFIG_FG_PERSIST))
+    {
+        fg_persist_checkpoint(selected_battery_model, soc);
+    }
+    sched_report_soc(pmic_ble_report.soc);
 
     return 0;
 }
 
-int pmic_fg_thread(void)
+// battery model, vbat sensor and LSLDO regulator, the fuel gauge itself starts with the first step
+int pmic_init(void)
 {
     if (IS_ENABLED(CONFIG_BATTERY_MODEL_ALKALINE_AA))
     {
@@ -190,7 +314,7 @@ int pmic_fg_thread(void)
     else
     {
         LOG_INF("Configuration error: no battery model selected.");
-        return 0;
+        return -EINVAL;
     }
 
     fuel_gauge_initialized = false;
@@ -198,58 +322,216 @@ int pmic_fg_thread(void)
     if (!device_is_ready(vbat))
     {
         LOG_ERR("vbat device not ready.");
-        return 0;
+        return -ENODEV;
     }
-    if (regulator_enable(npm2100_lsldo_regulator))
+    if (rtpm_get(RTPM_TWI) == 0)
     {
-        LOG_ERR("unable to enable regulator!");
+        if (regulator_enable(npm2100_lsldo_regulator))
+        {
+            LOG_ERR("unable to enable regulator!");
+        }
+        rtpm_put(RTPM_TWI);
+    }
+    if (IS_ENABLED(CONFIG_PMIC_EVENTS))
+    {
+        // without the interrupt line the fuel gauge keeps polling at the configured periods
+        (void)pmic_events_init();
     }
     LOG_INF("PMIC device ok");
-    k_sem_give(&sem_pmic_ready);
 
-    for (;;)
+    return 0;
+}
+
+// one fuel gauge update, initialises the fuel gauge on the first call
+int pmic_fg_step(void)
+{
+    int err = 0;
+
+    k_mutex_lock(&fg_lock, K_FOREVER);
+    if (!fuel_gauge_initialized)
     {
-        if (!fuel_gauge_initialized)
+        err = fuel_gauge_init(vbat, battery_model);
+        if (err < 0)
+        {
+            LOG_INF("Could not initialise fuel gauge.");
+        }
+        else
         {
-            int err;
-
-            err = fuel_gauge_init(vbat, battery_model);
-            if (err < 0)
-            {
-                LOG_INF("Could not initialise fuel gauge.");
-                return 0;
-            }
             LOG_INF("Fuel gauge initialised for %s battery.", battery_model_str[battery_model]);
-
             fuel_gauge_initialized = true;
         }
-        fuel_gauge_update(vbat);
-        k_msleep(PMIC_SLEEP_INTERVAL_MS);
     }
+    if (err == 0)
+    {
+        err = fuel_gauge_update(vbat);
+    }
+    k_mutex_unlock(&fg_lock);
+    return err;
 }
 
-// wait forever
-int pmic_reg_thread(void)
+int pmic_lsldo_set(int32_t requested_lsldo_mv)
 {
-    int err, requested_lsldo_uv;
-    int requested_lsldo_mv = -1;
-    for (;;)
+    int requested_lsldo_uv = requested_lsldo_mv * 1000; // api wants uV
+    int err;
+
+    err = rtpm_get(RTPM_TWI);
+    if (err)
     {
-        k_msgq_get(&ble_cfg_pmic_msgq, &requested_lsldo_mv, K_FOREVER); // suspend till msg avail
-        requested_lsldo_uv = requested_lsldo_mv * 1000;                 // api wants uV
-        err = regulator_set_voltage(npm2100_lsldo_regulator, requested_lsldo_uv, requested_lsldo_uv);
-        if (err)
+        return err;
+    }
+    err = regulator_set_voltage(npm2100_lsldo_regulator, requested_lsldo_uv, requested_lsldo_uv);
+    rtpm_put(RTPM_TWI);
+    counter_inc(COUNTER_REG_SET);
+    if (err)
+    {
+        LOG_ERR("Failed to set regulator voltage: %d uV, err: %d", requested_lsldo_uv, err);
+        return err;
+    }
+
+    LOG_INF("LSLDO Voltage set to: %d uV", requested_lsldo_uv);
+    telemetry_publish_lsldo_setpoint(requested_lsldo_mv);
+    sched_note_setpoint_change();
+    return 0;
+}
+
+int pmic_lsldo_get(int32_t *lsldo_mv)
+{
+    int32_t lsldo_uv;
+    int err;
+
+    err = rtpm_get(RTPM_TWI);
+    if (err)
+    {
+        return err;
+    }
+    err = regulator_get_voltage(npm2100_lsldo_regulator, &lsldo_uv);
+    rtpm_put(RTPM_TWI);
+    if (err)
+    {
+        LOG_ERR("Failed to get regulator voltage, err: %d", err);
+        return err;
+    }
+    *lsldo_mv = lsldo_uv / 1000;
+    return 0;
+}
+
+#if defined(CONFIG_BENCH)
+
+#define PMIC_BENCH_FG_STATE_MAX 512
+
+struct pmic_bench_fg
+{
+    float voltage;
+    float current;
+    float temp;
+};
+
+static volatile float bench_soc;
+
+static int bench_read_sensors(void *ctx)
+{
+    int32_t voltage_mv;
+    int32_t temp;
+
+    ARG_UNUSED(ctx);
+    return read_sensors(vbat, &voltage_mv, &temp);
+}
+
+static int bench_fg_process(void *ctx)
+{
+    const struct pmic_bench_fg *in = ctx;
+
+    bench_soc = nrf_fuel_gauge_process(in->voltage, in->current, in->temp, 1.f, NULL);
+    return 0;
+}
+
+int pmic_bench(uint32_t iterations)
+{
+    static uint8_t state[PMIC_BENCH_FG_STATE_MAX];
+    int32_t voltage_mv;
+    int32_t temp;
+    int err;
+
+    k_mutex_lock(&fg_lock, K_FOREVER);
+    if (!fuel_gauge_initialized)
+    {
+        k_mutex_unlock(&fg_lock);
+        LOG_WRN("Fuel gauge not running yet, PMIC cases skipped");
+        return -EAGAIN;
+    }
+
+    err = bench_measure("read_sensors", NULL, bench_read_sensors, NULL, iterations);
+    if (err == 0)
+    {
+        err = read_sensors(vbat, &voltage_mv, &temp);
+    }
+    // the gauge is stateful, the iterations run from a copy of its state that is put back afterwards
+    if (err == 0)
+    {
+        err = (nrf_fuel_gauge_state_size <= sizeof(state))
+                  ? nrf_fuel_gauge_state_get(state, nrf_fuel_gauge_state_size)
+                  : -ENOMEM;
+    }
+    if (err == 0)
+    {
+        struct pmic_bench_fg in = {
+            .voltage = (float)voltage_mv / 1000.f,
+            .current = (float)CONFIG_ENERGY_SLEEP_UA * 1e-6f,
+            .temp = (float)temp / 100.f,
+        };
+        struct nrf_fuel_gauge_init_parameters parameters = {
+            .model_primary = &battery_models[selected_battery_model],
+            .v0 = in.voltage,
+            .t0 = in.temp,
+            .state = state,
+        };
+
+        err = bench_measure("fg_process", NULL, bench_fg_process, &in, iterations);
+        if (nrf_fuel_gauge_init(&parameters, NULL) < 0)
         {
-            LOG_ERR("Failed to set regulator voltage: %d uV, err: %d", requested_lsldo_uv, err);
+            LOG_ERR("Could not restore the fuel gauge state");
         }
-        else
+    }
+    k_mutex_unlock(&fg_lock);
+    return err;
+}
+
+#endif // CONFIG_BENCH
+
+#if !defined(CONFIG_PIPELINE)
+
+int pmic_fg_thread(void)
+{
+    if (pmic_init() < 0)
+    {
+        return 0;
+    }
+    k_sem_give(&sem_pmic_ready);
+
+    for (;;)
+    {
+        if (pmic_fg_step() < 0 && !fuel_gauge_initialized)
         {
-            LOG_INF("LSLDO Voltage set to: %d uV", requested_lsldo_uv);
+            return 0;
         }
+        sched_sleep(SCHED_STAGE_FG);
+    }
+}
+
+// wait forever
+int pmic_reg_thread(void)
+{
+    int32_t requested_lsldo_mv = -1;
+    for (;;)
+    {
+        k_msgq_get(&ble_cfg_pmic_msgq, &requested_lsldo_mv, K_FOREVER); // suspend till msg avail
+        pmic_lsldo_set(requested_lsldo_mv);
     }
 }
 
 K_THREAD_DEFINE(pmic_reg_thread_id, PMIC_THREAD_STACK_SIZE, pmic_reg_thread, NULL, NULL, NULL, PMIC_THREAD_PRIORITY, 0,
                 0);
 K_THREAD_DEFINE(pmic_fg_thread_id, PMIC_THREAD_STACK_SIZE, pmic_fg_thread, NULL, NULL, NULL, PMIC_THREAD_PRIORITY, 0,
-                0);
\ No newline at end of file
+                0);
+
+#endif // CONFIG_PIPELINE
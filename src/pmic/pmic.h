@@ -19,13 +19,22 @@ enum battery_type
     BATTERY_TYPE_LITHIUM_CR2032,
 };
 
+// fixed point, 12 bytes, printed with the helpers in fixed_point.h
 struct pmic_report_msg
 {
-    double batt_voltage;
-    double temp;
-    double batt_soc;
+    uint32_t timestamp; // k_uptime_get_32() when the sample was taken
+    uint16_t vbat_mv;   // battery voltage, mV
+    int16_t temp;       // die temperature, 0.01 deg C
+    uint16_t soc;       // state of charge, 0.01 %
 };
 
 extern struct k_msgq ble_cfg_pmic_msgq;
 
+// steps shared by the PMIC threads and the pipeline
+int pmic_init(void);
+int pmic_fg_prefetch(void); // optional, starts the sensor read ahead of pmic_fg_step()
+int pmic_fg_step(void);
+int pmic_lsldo_set(int32_t requested_lsldo_mv);
+int pmic_lsldo_get(int32_t *lsldo_mv);
+
 #endif
\ No newline at end of file
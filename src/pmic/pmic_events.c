@@ -0,0 +1,201 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * pmic_events.c
+ * nPM2100 VBAT low, die temperature and regulator fault events from the MFD interrupt, wake the fuel gauge and BLE.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <errno.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/mfd/npm2100.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "counters.h"
+#include "pmic_events.h"
+#include "rtpm.h"
+#include "sched.h"
+#include "telemetry.h"
+
+LOG_MODULE_REGISTER(pmic_events, LOG_LEVEL_INF);
+
+#define PMIC_NODE DT_NODELABEL(npm2100ek_pmic)
+
+static const struct
+{
+    uint8_t mfd_event;
+    const char *name;
+} event_map[PMIC_EVENT_COUNT] = {
+    [PMIC_EVENT_VBAT_LOW] = {NPM2100_EVENT_BOOST_VBAT_WARN, "vbat low"},
+    [PMIC_EVENT_DIE_TEMP] = {NPM2100_EVENT_SYS_DIETEMP_WARN, "die temp"},
+    [PMIC_EVENT_VOUT_MIN] = {NPM2100_EVENT_BOOST_VOUT_MIN, "vout min"},
+    [PMIC_EVENT_LSLDO_OCP] = {NPM2100_EVENT_LDOSW_OCP, "lsldo ocp"},
+    [PMIC_EVENT_LSLDO_VINTERR] = {NPM2100_EVENT_LDOSW_VINTFAIL, "lsldo vint"},
+};
+
+static const struct device *pmic = DEVICE_DT_GET(PMIC_NODE);
+static const struct device *vbat = DEVICE_DT_GET(DT_NODELABEL(npm2100ek_vbat));
+
+static struct gpio_callback event_cb;
+static atomic_t pending;
+static struct k_spinlock stats_lock;
+static struct pmic_event_stats stats;
+
+// MFD work item context (system workqueue), the event registers were already read and cleared
+static void pmic_event_handler(const struct device *dev, struct gpio_callback *cb, gpio_port_pins_t pins)
+{
+    uint32_t now = k_uptime_get_32();
+    uint32_t mask = 0;
+
+    ARG_UNUSED(dev);
+    ARG_UNUSED(cb);
+
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    for (size_t i = 0; i < PMIC_EVENT_COUNT; i++)
+    {
+        if (pins & BIT(event_map[i].mfd_event))
+        {
+            mask |= BIT(i);
+            stats.count[i]++;
+            stats.last_timestamp[i] = MAX(now, 1);
+        }
+    }
+    k_spin_unlock(&stats_lock, key);
+
+    if (mask == 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < PMIC_EVENT_COUNT; i++)
+    {
+        if (mask & BIT(i))
+        {
+            LOG_WRN("nPM2100 event: %s", event_map[i].name);
+        }
+    }
+    counter_inc(COUNTER_PMIC_EVENT);
+    atomic_or(&pending, (atomic_val_t)mask);
+    telemetry_publish_pmic_events(mask);
+    sched_note_pmic_event();
+}
+
+// the vbat driver owns the threshold registers, a driver without the attribute keeps the nPM2100 default
+static void pmic_events_set_threshold(enum sensor_channel chan, enum sensor_attribute attr,
+                                      const struct sensor_value *val, const char *what)
+{
+    int err = sensor_attr_set(vbat, chan, attr, val);
+
+    if (err < 0)
+    {
+        LOG_WRN("Could not set the %s threshold (%d), the nPM2100 default applies", what, err);
+    }
+}
+
+int pmic_events_init(void)
+{
+    if (!DT_NODE_HAS_PROP(PMIC_NODE, host_int_gpios))
+    {
+        LOG_INF("No nPM2100 interrupt line (host-int-gpios), events disabled");
+        return -ENOTSUP;
+    }
+    if (!device_is_ready(pmic))
+    {
+        return -ENODEV;
+    }
+
+    struct sensor_value vbat_low;
+    struct sensor_value die_temp = {.val1 = CONFIG_PMIC_EVENTS_DIE_TEMP_C};
+    gpio_port_pins_t mask = 0;
+    int err;
+
+    sensor_value_from_milli(&vbat_low, CONFIG_PMIC_EVENTS_VBAT_LOW_MV);
+    for (size_t i = 0; i < PMIC_EVENT_COUNT; i++)
+    {
+        mask |= BIT(event_map[i].mfd_event);
+    }
+    gpio_init_callback(&event_cb, pmic_event_handler, mask);
+
+    err = rtpm_get(RTPM_TWI);
+    if (err < 0)
+    {
+        return err;
+    }
+    pmic_events_set_threshold(SENSOR_CHAN_GAUGE_VOLTAGE, SENSOR_ATTR_LOWER_THRESH, &vbat_low, "VBAT low");
+    pmic_events_set_threshold(SENSOR_CHAN_DIE_TEMP, SENSOR_ATTR_UPPER_THRESH, &die_temp, "die temperature");
+    // enables the event interrupts in the nPM2100
+    err = mfd_npm2100_add_callback(pmic, &event_cb);
+    rtpm_put(RTPM_TWI);
+    if (err < 0)
+    {
+        LOG_ERR("Could not register the nPM2100 event callback (%d)", err);
+        return err;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    stats.armed = true;
+    k_spin_unlock(&stats_lock, key);
+
+    // the interrupt reports what the routine polling was watching for, so that polling can back off
+    uint32_t min_ms;
+    uint32_t max_ms;
+
+    sched_get_limits(SCHED_STAGE_FG, &min_ms, &max_ms);
+    max_ms = MAX(max_ms, CONFIG_PMIC_EVENTS_FG_PERIOD_MAX_S * MSEC_PER_SEC);
+    err = sched_set_limits(SCHED_STAGE_FG, min_ms, max_ms);
+    LOG_INF("nPM2100 events armed, VBAT low %d mV, die temp %d C", CONFIG_PMIC_EVENTS_VBAT_LOW_MV,
+            CONFIG_PMIC_EVENTS_DIE_TEMP_C);
+    return err;
+}
+
+uint32_t pmic_events_claim(void)
+{
+    return (uint32_t)atomic_clear(&pending);
+}
+
+void pmic_events_unclaim(uint32_t events)
+{
+    atomic_or(&pending, (atomic_val_t)events);
+}
+
+void pmic_events_get_stats(struct pmic_event_stats *out)
+{
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    *out = stats;
+    k_spin_unlock(&stats_lock, key);
+}
+
+#if defined(CONFIG_SHELL)
+
+static int cmd_pmic_events(const struct shell *sh, size_t argc, char **argv)
+{
+    struct pmic_event_stats st;
+    uint32_t now = k_uptime_get_32();
+
+    pmic_events_get_stats(&st);
+    shell_print(sh, "interrupt line: %s", st.armed ? "armed" : "not available, polling only");
+    shell_print(sh, "%-12s %8s %12s", "event", "count", "last (s ago)");
+    for (size_t i = 0; i < PMIC_EVENT_COUNT; i++)
+    {
+        if (st.last_timestamp[i])
+        {
+            shell_print(sh, "%-12s %8u %12u", event_map[i].name, st.count[i], (now - st.last_timestamp[i]) / 1000);
+        }
+        else
+        {
+            shell_print(sh, "%-12s %8u %12s", event_map[i].name, st.count[i], "-");
+        }
+    }
+    return 0;
+}
+
+SHELL_CMD_REGISTER(pmic_events, NULL, "nPM2100 threshold and fault events", cmd_pmic_events);
+
+#endif
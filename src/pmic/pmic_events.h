@@ -0,0 +1,39 @@
+#ifndef PMIC_EVENTS_H_
+#define PMIC_EVENTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* nPM2100 threshold and fault events, delivered through the MFD interrupt line (host-int-gpios).
+ * An event wakes the fuel gauge at once, the fuel gauge step that reads the new values then
+ * wakes the BLE publisher, which notifies them regardless of the deadbands.
+ */
+enum pmic_event
+{
+    PMIC_EVENT_VBAT_LOW,      // battery below CONFIG_PMIC_EVENTS_VBAT_LOW_MV
+    PMIC_EVENT_DIE_TEMP,      // die temperature above CONFIG_PMIC_EVENTS_DIE_TEMP_C
+    PMIC_EVENT_VOUT_MIN,      // BOOST output fell below its minimum
+    PMIC_EVENT_LSLDO_OCP,     // LDO/LS over-current
+    PMIC_EVENT_LSLDO_VINTERR, // LDO/LS internal supply failure
+    PMIC_EVENT_COUNT,
+};
+
+struct pmic_event_stats
+{
+    bool armed; // interrupt line present and callbacks registered
+    uint32_t count[PMIC_EVENT_COUNT];
+    uint32_t last_timestamp[PMIC_EVENT_COUNT]; // k_uptime_get_32(), 0 if never seen
+};
+
+// program the thresholds and register the callbacks, -ENOTSUP without an interrupt line
+int pmic_events_init(void);
+
+// events not yet served by a fuel gauge step (enum pmic_event bits), cleared by the call
+uint32_t pmic_events_claim(void);
+
+// hand claimed events back after a failed step, the next step serves them
+void pmic_events_unclaim(uint32_t events);
+
+void pmic_events_get_stats(struct pmic_event_stats *out);
+
+#endif
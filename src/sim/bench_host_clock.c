@@ -0,0 +1,19 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * bench_host_clock.c
+ * host monotonic clock for the benchmarks on native_sim, built into the runner with the host C library.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+// simulated time stands still while the embedded code runs, so the host clock times it
+uint64_t bench_host_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,110 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * emul_npm2100.c
+ * register-file I2C emulator for the nPM2100, used by the native_sim build.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#define DT_DRV_COMPAT nordic_npm2100
+
+#include <string.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/i2c_emul.h>
+#include <zephyr/logging/log.h>
+
+#include "emul_npm2100.h"
+
+LOG_MODULE_REGISTER(emul_npm2100, LOG_LEVEL_INF);
+
+// writes are stored and read back, so the MFD, regulator and GPIO drivers see a coherent device
+#define NPM2100_VBAT_DEFAULT 0x77U // ~1.5 V, a fresh AA cell
+#define NPM2100_TEMP_DEFAULT 0xB1U // ~25 deg C
+#define NPM2100_VOUT_DEFAULT 0xEFU // ~3.0 V
+
+struct emul_npm2100_data
+{
+    struct i2c_emul emul;
+    uint8_t regs[256];
+};
+
+struct emul_npm2100_cfg
+{
+    uint16_t addr;
+};
+
+static int emul_npm2100_transfer(const struct emul *target, struct i2c_msg *msgs, int num_msgs, int addr)
+{
+    struct emul_npm2100_data *data = target->data;
+    bool have_reg = false;
+    uint8_t reg = 0;
+
+    for (int i = 0; i < num_msgs; i++)
+    {
+        struct i2c_msg *msg = &msgs[i];
+        uint32_t pos = 0;
+
+        if (msg->flags & I2C_MSG_READ)
+        {
+            for (; pos < msg->len; pos++)
+            {
+                msg->buf[pos] = data->regs[reg++];
+            }
+            continue;
+        }
+
+        // the first byte written in a transaction is the register address
+        if (!have_reg && msg->len > 0)
+        {
+            reg = msg->buf[pos++];
+            have_reg = true;
+        }
+        for (; pos < msg->len; pos++)
+        {
+            data->regs[reg++] = msg->buf[pos];
+        }
+    }
+
+    return 0;
+}
+
+static const struct i2c_emul_api emul_npm2100_api = {
+    .transfer = emul_npm2100_transfer,
+};
+
+void emul_npm2100_reg_set(const struct emul *target, uint8_t reg, uint8_t val)
+{
+    struct emul_npm2100_data *data = target->data;
+
+    data->regs[reg] = val;
+}
+
+uint8_t emul_npm2100_reg_get(const struct emul *target, uint8_t reg)
+{
+    struct emul_npm2100_data *data = target->data;
+
+    return data->regs[reg];
+}
+
+static int emul_npm2100_init(const struct emul *target, const struct device *parent)
+{
+    struct emul_npm2100_data *data = target->data;
+
+    ARG_UNUSED(parent);
+    memset(data->regs, 0, sizeof(data->regs));
+    data->regs[NPM2100_ADC_READVBAT] = NPM2100_VBAT_DEFAULT;
+    data->regs[NPM2100_ADC_READTEMP] = NPM2100_TEMP_DEFAULT;
+    data->regs[NPM2100_ADC_READVOUT] = NPM2100_VOUT_DEFAULT;
+
+    return 0;
+}
+
+#define EMUL_NPM2100_DEFINE(n)                                                                                         \
+    static struct emul_npm2100_data emul_npm2100_data_##n;                                                             \
+    static const struct emul_npm2100_cfg emul_npm2100_cfg_##n = {.addr = DT_INST_REG_ADDR(n)};                         \
+    EMUL_DT_INST_DEFINE(n, emul_npm2100_init, &emul_npm2100_data_##n, &emul_npm2100_cfg_##n, &emul_npm2100_api,       \
+                        NULL)
+
+DT_INST_FOREACH_STATUS_OKAY(EMUL_NPM2100_DEFINE)
@@ -0,0 +1,16 @@
+#ifndef EMUL_NPM2100_H_
+#define EMUL_NPM2100_H_
+
+#include <stdint.h>
+#include <zephyr/drivers/emul.h>
+
+// ADC result registers read by the vbat sensor driver after it triggers a measurement
+#define NPM2100_ADC_READVBAT 0x96U // 3200 mV / 256 per LSB
+#define NPM2100_ADC_READTEMP 0x97U
+#define NPM2100_ADC_READVOUT 0x99U
+
+// poke the emulated register file, e.g. to simulate a draining battery
+void emul_npm2100_reg_set(const struct emul *target, uint8_t reg, uint8_t val);
+uint8_t emul_npm2100_reg_get(const struct emul *target, uint8_t reg);
+
+#endif
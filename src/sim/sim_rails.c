@@ -0,0 +1,54 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * sim_rails.c
+ * drives the emulated SAADC channels on native_sim with plausible BOOST and LSLDO voltages.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/adc/adc_emul.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+
+#include "telemetry.h"
+
+LOG_MODULE_REGISTER(sim_rails, LOG_LEVEL_INF);
+
+#define SIM_BOOST_MV 3000
+#define SIM_LSLDO_DEFAULT_MV 1800
+
+static const struct device *adc_dev = DEVICE_DT_GET(DT_IO_CHANNELS_CTLR_BY_IDX(DT_PATH(zephyr_user), 0));
+
+// the emulated LSLDO rail follows the setpoint the regulator thread last applied
+static int sim_lsldo_value(const struct device *dev, unsigned int chan, void *data, uint32_t *result)
+{
+    struct telemetry_snapshot snap;
+
+    ARG_UNUSED(dev);
+    ARG_UNUSED(chan);
+    ARG_UNUSED(data);
+    telemetry_read(&snap);
+    *result = snap.lsldo_gen ? snap.lsldo_setpoint_mv : SIM_LSLDO_DEFAULT_MV;
+    return 0;
+}
+
+static int sim_rails_init(void)
+{
+    int err;
+
+    err = adc_emul_const_value_set(adc_dev, DT_IO_CHANNELS_INPUT_BY_IDX(DT_PATH(zephyr_user), 0), SIM_BOOST_MV);
+    if (!err)
+    {
+        err = adc_emul_value_func_set(adc_dev, DT_IO_CHANNELS_INPUT_BY_IDX(DT_PATH(zephyr_user), 1),
+                                      sim_lsldo_value, NULL);
+    }
+    if (err)
+    {
+        LOG_ERR("Could not set up emulated ADC inputs (err %d)", err);
+    }
+    return err;
+}
+
+SYS_INIT(sim_rails_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
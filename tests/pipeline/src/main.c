@@ -0,0 +1,142 @@
+/*
+ * npm2100_nrf54l15_BFG
+ * main.c
+ * native_sim test of the sample -> fuel gauge -> publish path against the emulated nPM2100 and SAADC.
+ * auth: ddhd
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/adc/adc_emul.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/ztest.h>
+
+#include "ble_history.h"
+#include "ble_periph_pmic.h"
+#include "ble_record.h"
+#include "bench.h"
+#include "emul_npm2100.h"
+#include "npm_adc.h"
+#include "pmic.h"
+#include "telemetry.h"
+
+#define VBAT_CODE 0x70U // 1400 mV at 3200 mV / 256 per LSB
+#define VBAT_MV 1400
+#define VBAT_LSB_MV 13
+#define BOOST_MV 2900
+#define LSLDO_MV 1500
+#define RAIL_TOL_MV 2 // ADC emulator quantisation and the mV conversion
+#define ITERATIONS 50
+
+static const struct emul *pmic_emul = EMUL_DT_GET(DT_NODELABEL(npm2100ek_pmic));
+static const struct device *adc_dev = DEVICE_DT_GET(DT_IO_CHANNELS_CTLR_BY_IDX(DT_PATH(zephyr_user), 0));
+
+// next history record the test has not looked at
+static uint32_t cursor;
+
+static void set_inputs(uint8_t vbat_code, uint32_t boost_mv, uint32_t lsldo_mv)
+{
+    emul_npm2100_reg_set(pmic_emul, NPM2100_ADC_READVBAT, vbat_code);
+    zassert_ok(adc_emul_const_value_set(adc_dev, DT_IO_CHANNELS_INPUT_BY_IDX(DT_PATH(zephyr_user), NPM_ADC_CH_BOOST),
+                                        boost_mv));
+    zassert_ok(adc_emul_const_value_set(adc_dev, DT_IO_CHANNELS_INPUT_BY_IDX(DT_PATH(zephyr_user), NPM_ADC_CH_LSLDO),
+                                        lsldo_mv));
+}
+
+// one pass of what the pipeline runs per tick
+static int pipeline_iteration(void *ctx)
+{
+    int err;
+
+    ARG_UNUSED(ctx);
+    err = npm_adc_step();
+    if (err == 0)
+    {
+        err = pmic_fg_step();
+    }
+    if (err == 0)
+    {
+        err = ble_publish();
+    }
+    return err;
+}
+
+// untimed, the fuel gauge needs simulated time to pass between updates
+static int pipeline_wait(void *ctx)
+{
+    ARG_UNUSED(ctx);
+    k_sleep(K_SECONDS(1));
+    return 0;
+}
+
+static void *pipeline_setup(void)
+{
+    zassert_ok(pmic_init());
+    zassert_ok(npm_adc_init());
+    cursor = ble_history_undelivered();
+    return NULL;
+}
+
+ZTEST(pipeline, test_snapshot_and_record)
+{
+    struct telemetry_snapshot snap;
+    struct ble_record rec;
+    struct ble_record decoded;
+    uint8_t buf[sizeof(struct ble_record)];
+
+    set_inputs(VBAT_CODE, BOOST_MV, LSLDO_MV);
+    (void)pipeline_wait(NULL);
+    zassert_ok(pipeline_iteration(NULL));
+
+    telemetry_read(&snap);
+    zassert_true(snap.adc_gen > 0 && snap.pmic_gen > 0, "both producers published");
+    zassert_within(snap.adc.channel_mv[NPM_ADC_CH_BOOST], BOOST_MV, RAIL_TOL_MV);
+    zassert_within(snap.adc.channel_mv[NPM_ADC_CH_LSLDO], LSLDO_MV, RAIL_TOL_MV);
+    zassert_within(snap.pmic.vbat_mv, VBAT_MV, VBAT_LSB_MV);
+    zassert_true(snap.pmic.soc <= 10000, "SoC %u out of range", snap.pmic.soc);
+
+    // the publisher queued exactly this sample
+    zassert_equal(ble_history_pending(cursor), 1);
+    zassert_equal(ble_history_read(&cursor, &rec, 1), 1);
+    ble_history_advance(&cursor, 1);
+    zassert_equal(rec.timestamp, snap.pmic.timestamp);
+    zassert_equal(rec.soc, snap.pmic.soc);
+    zassert_equal(rec.vbat, snap.pmic.vbat_mv);
+    zassert_equal(rec.temp, snap.pmic.temp);
+    zassert_equal(rec.boost, snap.adc.channel_mv[NPM_ADC_CH_BOOST]);
+    zassert_equal(rec.lsldo, snap.adc.channel_mv[NPM_ADC_CH_LSLDO]);
+
+    // on-air layout, see ble_record.h
+    zassert_equal(ble_record_encode(&rec, buf), sizeof(buf));
+    zassert_equal(buf[0], BLE_RECORD_VERSION);
+    zassert_equal(sys_get_le16(&buf[2]), rec.seq);
+    zassert_equal(sys_get_le32(&buf[4]), snap.pmic.timestamp);
+    zassert_equal(sys_get_le16(&buf[8]), snap.pmic.soc);
+    zassert_equal(sys_get_le16(&buf[10]), snap.pmic.vbat_mv);
+    zassert_equal((int16_t)sys_get_le16(&buf[12]), snap.pmic.temp);
+    zassert_equal((int16_t)sys_get_le16(&buf[14]), snap.adc.channel_mv[NPM_ADC_CH_BOOST]);
+    zassert_equal((int16_t)sys_get_le16(&buf[16]), snap.adc.channel_mv[NPM_ADC_CH_LSLDO]);
+    zassert_ok(ble_record_decode(buf, sizeof(buf), &decoded));
+    zassert_mem_equal(&decoded, &rec, sizeof(rec));
+}
+
+ZTEST(pipeline, test_iteration_time)
+{
+    struct telemetry_snapshot snap;
+    uint32_t start = cursor;
+
+    set_inputs(VBAT_CODE, BOOST_MV, LSLDO_MV);
+    // prints the BENCH line, comparable with scripts/bench_compare.py
+    zassert_ok(bench_measure("pipeline_iteration", pipeline_wait, pipeline_iteration, NULL, ITERATIONS));
+
+    // every sample goes into the history ring, whatever the deadbands
+    zassert_equal(ble_history_pending(start), ITERATIONS);
+    telemetry_read(&snap);
+    zassert_within(snap.pmic.vbat_mv, VBAT_MV, VBAT_LSB_MV);
+    cursor = start + ITERATIONS;
+}
+
+ZTEST_SUITE(pipeline, NULL, pipeline_setup, NULL, NULL, NULL);